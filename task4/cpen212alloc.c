@@ -12,21 +12,25 @@ Heap Memory Layout:
 Heap Size ((sizeof(size_t) bytes) <--heap handle points here
 Block Header (sizeof(blockHeader) bytes) (8 for now)
 User-Usable Space (8 byte aligned)
-Footer (sizeof(size_t) bytes)
+Footer (sizeof(size_t) bytes, free blocks only)
 ...more blocks
 
 Block Structure:
 1. Header (blockHeader struct):
     -size field (size_t): Contains both size and allocation status
     -least significant bit used as allocated/free flag (1 = allocated, 0 = free)
+    -second bit (BLOCK_PREV_ALLOCATED) set when the block right before is allocated
+     (the first block counts the heap size word as an allocated predecessor)
     -actual block size stored in upper bits (masked with BLOCK_SIZE_MASK)
-    -size includes usable space header and footer
+    -size includes header, usable space and the footer if there is one
 2. User-Usable Space:
     -starts immediately after the header
     -8-byte aligned for proper memory alignment
-3. Footer:
-    -size field (size_t): Contains the same value as the header
+    -while the block is allocated it runs to the end of the block (no footer)
+3. Footer (free blocks only):
+    -size field (size_t): Contains the block size from the header, without the flags
     -placed at the end of the block
+    -only read when the next block's BLOCK_PREV_ALLOCATED bit is clear, to find this block
 */
 
 // void *cpen212_init(void *heap_start, void *heap_end) {
@@ -45,7 +49,7 @@ void *cpen212_init(void *heap_start, void *heap_end) {
 
     //initialize first block (after the heap size)
     blockHeader *firstBlock = (blockHeader *)((char *)heap_start + sizeof(size_t));
-    firstBlock->size = heap_size - sizeof(size_t);  //size includes header and payload
+    firstBlock->size = (heap_size - sizeof(size_t)) | BLOCK_PREV_ALLOCATED;  //size includes header and payload
     setBlockAllocated(firstBlock, false);
     setBlockFooter(firstBlock); //set footer for first block
 
@@ -73,8 +77,8 @@ void *cpen212_alloc(void *heap_handle, size_t nbytes) {
     //make sure the requested size is 8-byte aligned
     size_t alignedSize = (nbytes + 7) & ~7;
 
-    //calculate total size needed (payload + header)
-    size_t totalSize = alignedSize + sizeof(blockHeader) + sizeof(size_t); //add size for footer
+    //calculate total size needed (payload + header), allocated blocks have no footer
+    size_t totalSize = alignedSize + sizeof(blockHeader);
 
     //traverse heap linearly
     while ((char *)current < (char *)heap_handle + heap_size) {
@@ -85,20 +89,25 @@ void *cpen212_alloc(void *heap_handle, size_t nbytes) {
             if (remainingSize >= sizeof(blockHeader) + sizeof(size_t)) {
                 //splitting
                 blockHeader *newBlock = (blockHeader *)((char *)current + totalSize);
-                newBlock->size = remainingSize;
+                newBlock->size = remainingSize | BLOCK_PREV_ALLOCATED;
                 setBlockAllocated(newBlock, false);
                 setBlockFooter(newBlock);
 
-                //update the current block's size
-                current->size = totalSize;
+                //update the current block's size, keeping its flags
+                setBlockSize(current, totalSize);
             } else {
                 //if remaining space is too small use the entire block
                 totalSize = getBlockSize(current);
+
+                //the next block now follows an allocated block
+                blockHeader *nextBlock = (blockHeader *)((char *)current + totalSize);
+                if ((char *)nextBlock < (char *)heap_handle + heap_size) {
+                    setPrevBlockAllocated(nextBlock, true);
+                }
             }
 
             //set current block as allocated
             setBlockAllocated(current, true);
-            setBlockFooter(current);
             //return address of the usable space (after the block header)
             return (void *)((char *)current + sizeof(blockHeader));
         }
@@ -124,20 +133,14 @@ void cpen212_free(void *heap_handle, void *p) {
     //get heap size for boundary checking
     size_t heap_size = getHeapSize(heap_handle);
 
-    //backwards coalescing - check if previous block exists and is free
-    if ((char *)block > (char *)heap_handle + sizeof(size_t)) {
-        // Get previous block's footer
-        size_t *prevFooter = (size_t *)((char *)block - sizeof(size_t));
-        
-        // If previous block exists and is free
-        if (!(*prevFooter & BLOCK_ALLOCATED)) {
-            size_t prevSize = *prevFooter & BLOCK_SIZE_MASK;
-            blockHeader *prevBlock = (blockHeader *)((char *)block - prevSize);
-            
-            // Update previous block's size to include current block
-            prevBlock->size = getBlockSize(prevBlock) + getBlockSize(block);
-            block = prevBlock; // Update block pointer for forward coalescing
-        }
+    //backwards coalescing - the previous block only has a footer to find it by if it is free
+    if (!isPrevBlockAllocated(block)) {
+        blockHeader *prevBlock = getPrevBlock(block);
+        assert(!isBlockAllocated(prevBlock));
+
+        // Update previous block's size to include current block
+        setBlockSize(prevBlock, getBlockSize(prevBlock) + getBlockSize(block));
+        block = prevBlock; // Update block pointer for forward coalescing
     }
 
     //forward coalescing - check if next block exists and is free
@@ -148,11 +151,16 @@ void cpen212_free(void *heap_handle, void *p) {
         //if next block is free merge w current block
         if (!isBlockAllocated(nextBlock)) {
             //update current block size to include next block
-            block->size = getBlockSize(block) + getBlockSize(nextBlock);
-            
+            setBlockSize(block, getBlockSize(block) + getBlockSize(nextBlock));
+            nextBlock = (blockHeader *)((char *)block + getBlockSize(block));
         }
     }
     setBlockFooter(block);  //update footer after coalescing
+
+    //the block after the coalesced one now follows a free block
+    if ((char *)nextBlock < (char *)heap_handle + heap_size) {
+        setPrevBlockAllocated(nextBlock, false);
+    }
 }
 
 void *cpen212_realloc(void *heap_handle, void *prev, size_t nbytes) {
@@ -167,7 +175,7 @@ void *cpen212_realloc(void *heap_handle, void *prev, size_t nbytes) {
 
     //get old block header and its size
     blockHeader *oldBlock = (blockHeader *)((char *)prev - sizeof(blockHeader));
-    size_t oldSize = getBlockSize(oldBlock) - sizeof(blockHeader) - sizeof(size_t);
+    size_t oldSize = getBlockSize(oldBlock) - sizeof(blockHeader);
 
     //allocate new block of requested size
     void *newBlock = cpen212_alloc(heap_handle, nbytes);
@@ -14,8 +14,10 @@ typedef struct blockHeader {
     size_t size; 
 } __attribute__((aligned(8)))blockHeader;
 
-#define BLOCK_ALLOCATED  ((size_t)1) // Use least significant bit
-#define BLOCK_SIZE_MASK  (~BLOCK_ALLOCATED) // Mask to extract actual size
+#define BLOCK_ALLOCATED       ((size_t)1) // Use least significant bit
+#define BLOCK_PREV_ALLOCATED  ((size_t)2) // Set when the block right before this one is allocated
+#define BLOCK_FLAGS_MASK      ((size_t)7) // Sizes are multiples of 8, so the low 3 bits are flags
+#define BLOCK_SIZE_MASK       (~BLOCK_FLAGS_MASK) // Mask to extract actual size
 
 static inline size_t getBlockSize(blockHeader *block) {
     return block->size & BLOCK_SIZE_MASK;
@@ -30,10 +32,28 @@ static inline void setBlockAllocated(blockHeader *block, bool allocated) {
         block->size |= BLOCK_ALLOCATED;
     }
     else {
-        block->size &= BLOCK_SIZE_MASK;
+        block->size &= ~BLOCK_ALLOCATED;
     }
 }
 
+static inline bool isPrevBlockAllocated(blockHeader *block) {
+    return (block->size & BLOCK_PREV_ALLOCATED) != 0;
+}
+
+static inline void setPrevBlockAllocated(blockHeader *block, bool allocated) {
+    if(allocated) {
+        block->size |= BLOCK_PREV_ALLOCATED;
+    }
+    else {
+        block->size &= ~BLOCK_PREV_ALLOCATED;
+    }
+}
+
+//change the size of a block, keeping its flags
+static inline void setBlockSize(blockHeader *block, size_t size) {
+    block->size = size | (block->size & BLOCK_FLAGS_MASK);
+}
+
 static inline size_t getHeapSize(void *heap_handle) {
     return *((size_t *)heap_handle);
 }
@@ -42,11 +62,13 @@ static inline size_t *getBlockFooter(blockHeader *block) {
     return (size_t *)((char *)block + getBlockSize(block) - sizeof(size_t));
 }
 
+//the footer only holds the size, since the flags in the header change while the block is free
 static inline void setBlockFooter(blockHeader *block) {
     size_t *footer = getBlockFooter(block);
-    *footer = block->size;
+    *footer = getBlockSize(block);
 }
 
+//only free blocks have footers, so this is only valid when !isPrevBlockAllocated(block)
 static inline blockHeader *getPrevBlock(blockHeader *block) {
     size_t *prevFooter = (size_t *)((char *)block - sizeof(size_t));
     size_t prevSize = *prevFooter & BLOCK_SIZE_MASK;
@@ -6,52 +6,1009 @@
 
 // CHANGE THIS FILE to implement your heap allocator for each task
 
-/* 
+/*
 Heap Memory Layout:
 
-Heap Size ((sizeof(size_t) bytes) <--heap handle points here
+Heap State (sizeof(heapState) bytes) <--heap handle points here
+    -heap size (size_t), with the placement policy in its low 2 bits and
+     HEAP_LAST_ALLOCATED in bit 2 (the heap end's view of the last block, for cpen212_extend)
+    -segregated free list heads (NUM_SIZE_CLASSES pointers)
+    -large free block tree root (treeBlock pointer)
+    -slab directory pointer (NULL until the first slab page is made)
+    -with CPEN212_STATS, the heap counters; with CPEN212_PROFILE, a pointer to the latency profile;
+     with CPEN212_SAMPLE, a pointer to the allocation sampler
 Block Header (sizeof(blockHeader) bytes) (8 for now)
 User-Usable Space (8 byte aligned)
-Footer (sizeof(size_t) bytes)
+Footer (sizeof(size_t) bytes, free blocks only)
 ...more blocks
 
 Block Structure:
 1. Header (blockHeader struct):
     -size field (size_t): Contains both size and allocation status
     -least significant bit used as allocated/free flag (1 = allocated, 0 = free)
+    -second bit (BLOCK_PREV_ALLOCATED) set when the block right before is allocated
+     (the first block counts the heap state as an allocated predecessor)
+    -third bit (BLOCK_KNOWN_ZERO) set on a free block that has never held data, i.e.,
+     its usable space is all zero apart from the free list links and the footer;
+     only heaps made with cpen212_init_zeroed start with such a block, splitting one keeps
+     the bit on the free remainder, and allocated blocks never carry it
     -actual block size stored in upper bits (masked with BLOCK_SIZE_MASK)
-    -size includes the usable space header and footer
+    -size includes the header, the usable space and the footer if there is one
 2. User-Usable Space:
     -starts immediately after the header
     -8-byte aligned for proper memory alignment
-3. Footer:
-    -size field (size_t): Contains the same value as the header
+    -while the block is allocated it runs to the end of the block (no footer)
+    -while the block is free, the first 16 bytes hold the next/prev free list links (freeBlock struct)
+3. Footer (free blocks only):
+    -size field (size_t): Contains the block size from the header, without the flags
     -placed at the end of the block
+    -only read when the next block's BLOCK_PREV_ALLOCATED bit is clear, to find this block
+    -its lowest bit (FOOTER_PURGED) is set by cpen212_purge once the block's interior pages
+     were handed back, and cleared whenever the block changes and its footer is rewritten
+
+Free Lists:
+    -every free block is on exactly one circular doubly-linked list, picked by getSizeClass(block size)
+    -where a new free block goes on its list depends on the placement policy (see cpen212common.h):
+     pushed at the head (first/best fit), just behind the rover at the head (next fit),
+     or in address order (address-ordered first fit)
+    -blocks are always at least MIN_BLOCK_SIZE bytes so the links and footer fit
+    -free blocks of LARGE_BLOCK_SIZE or more are instead in a splay tree keyed by (size, address),
+     with the left/right child links in the same place as the list links (treeBlock struct)
+    -with CPEN212_TLSF the lists are the two-level TLSF index and the heap state also
+     carries its bitmaps, so the prologue grows to sizeof(heapState) (see cpen212common.h)
+
+Slab Pages (requests of up to SLAB_MAX_SIZE bytes on heaps of at least SLAB_MIN_HEAP_SIZE):
+    -an ordinary allocated block whose payload is SLAB_PAGE_SIZE bytes on a SLAB_PAGE_SIZE boundary
+    -payload starts with a slabPage header (magic, partial list links, slot size, free slot bitmap)
+    -the rest of the payload is an array of equal slots handed out without any header
+    -cpen212_free/cpen212_realloc recognise a slot by rounding down to the page boundary
+     and checking the page magic, and fall back to the block header otherwise
 */
 
+#ifdef CPEN212_TLSF
+//keep the two-level bitmaps in sync with whether list sizeClass is empty
+static void updateClassBitmaps(heapState *state, size_t sizeClass) {
+    size_t fl = sizeClass / TLSF_SL_COUNT;
+    size_t sl = sizeClass % TLSF_SL_COUNT;
+
+    if (state->freeLists[sizeClass]) {
+        state->slBitmap[fl] |= (uint8_t)(1u << sl);
+        state->flBitmap |= (uint64_t)1 << fl;
+    } else {
+        state->slBitmap[fl] &= (uint8_t)~(1u << sl);
+        if (!state->slBitmap[fl]) {
+            state->flBitmap &= ~((uint64_t)1 << fl);
+        }
+    }
+}
+#endif
+
+#ifndef CPEN212_TLSF
+//order tree nodes by size, then by address: <0 if (size, addr) sorts before node
+static int compareTreeKey(size_t size, uintptr_t addr, treeBlock *node) {
+    size_t nodeSize = getBlockSize(&node->header);
+    if (size != nodeSize) {
+        return size < nodeSize ? -1 : 1;
+    }
+    if (addr != (uintptr_t)node) {
+        return addr < (uintptr_t)node ? -1 : 1;
+    }
+    return 0;
+}
+
+//top-down splay: bring the node with key (size, addr), or the last node on the
+//search path for it, to the root, and return the new root
+static treeBlock *splayTree(treeBlock *root, size_t size, uintptr_t addr) {
+    treeBlock split; //left and right trees hang off split.right and split.left
+    treeBlock *leftMax = &split;
+    treeBlock *rightMin = &split;
+    treeBlock *node = root;
+
+    split.left = NULL;
+    split.right = NULL;
+    for (;;) {
+        int cmp = compareTreeKey(size, addr, node);
+        if (cmp < 0) {
+            if (!node->left) {
+                break;
+            }
+            if (compareTreeKey(size, addr, node->left) < 0) {
+                //rotate right
+                treeBlock *child = node->left;
+                node->left = child->right;
+                child->right = node;
+                node = child;
+                if (!node->left) {
+                    break;
+                }
+            }
+            //link right
+            rightMin->left = node;
+            rightMin = node;
+            node = node->left;
+        } else if (cmp > 0) {
+            if (!node->right) {
+                break;
+            }
+            if (compareTreeKey(size, addr, node->right) > 0) {
+                //rotate left
+                treeBlock *child = node->right;
+                node->right = child->left;
+                child->left = node;
+                node = child;
+                if (!node->right) {
+                    break;
+                }
+            }
+            //link left
+            leftMax->right = node;
+            leftMax = node;
+            node = node->right;
+        } else {
+            break;
+        }
+    }
+
+    //reassemble
+    leftMax->right = node->left;
+    rightMin->left = node->right;
+    node->left = split.right;
+    node->right = split.left;
+    return node;
+}
+
+static void insertTreeBlock(heapState *state, treeBlock *node) {
+    treeBlock *root = state->largeBlocks;
+    size_t size = getBlockSize(&node->header);
+
+    if (!root) {
+        node->left = NULL;
+        node->right = NULL;
+    } else {
+        root = splayTree(root, size, (uintptr_t)node);
+        if (compareTreeKey(size, (uintptr_t)node, root) < 0) {
+            node->left = root->left;
+            node->right = root;
+            root->left = NULL;
+        } else {
+            node->right = root->right;
+            node->left = root;
+            root->right = NULL;
+        }
+    }
+    state->largeBlocks = node;
+}
+
+static void removeTreeBlock(heapState *state, treeBlock *node) {
+    size_t size = getBlockSize(&node->header);
+    treeBlock *root = splayTree(state->largeBlocks, size, (uintptr_t)node);
+
+    assert(root == node);
+    if (!root->left) {
+        root = root->right;
+    } else {
+        //every key on the left is smaller, so this brings the left subtree's maximum up
+        treeBlock *right = root->right;
+        root = splayTree(root->left, size, (uintptr_t)node);
+        assert(!root->right);
+        root->right = right;
+    }
+    state->largeBlocks = root;
+}
+
+//smallest large block of at least totalSize bytes (lowest address on ties), or NULL
+static treeBlock *findTreeBlock(heapState *state, size_t totalSize) {
+    if (!state->largeBlocks) {
+        return NULL;
+    }
+
+    treeBlock *root = splayTree(state->largeBlocks, totalSize, 0);
+    state->largeBlocks = root;
+    if (getBlockSize(&root->header) >= totalSize) {
+        return root;
+    }
+
+    //root is the largest block below totalSize, so the answer is the smallest one to its right
+    treeBlock *node = root->right;
+    while (node && node->left) {
+        node = node->left;
+    }
+    return node;
+}
+
+//next large block after node in (size, address) order, or NULL
+static treeBlock *getNextTreeBlock(heapState *state, treeBlock *node) {
+    size_t size = getBlockSize(&node->header);
+    treeBlock *next = NULL;
+
+    for (treeBlock *current = state->largeBlocks; current; ) {
+        if (compareTreeKey(size, (uintptr_t)node, current) < 0) {
+            next = current;
+            current = current->left;
+        } else {
+            current = current->right;
+        }
+    }
+    return next;
+}
+#endif
+
+//count a block of size bytes joining (added) or leaving the free lists (CPEN212_STATS builds only)
+static inline void recordFreeBlock(void *heap_handle, size_t size, bool added) {
+#ifdef CPEN212_STATS
+    heapStats *stats = &((heapState *)heap_handle)->stats;
+    size_t bucket = (size_t)(63 - __builtin_clzl(size));
+    if (added) {
+        stats->freeBlocks++;
+        stats->freeBytes += size;
+        stats->freeBuckets[bucket]++;
+    } else {
+        stats->freeBlocks--;
+        stats->freeBytes -= size;
+        stats->freeBuckets[bucket]--;
+    }
+#else
+    (void)heap_handle;
+    (void)size;
+    (void)added;
+#endif
+}
+
+//count n blocks split off (n > 0) or merged away (n < 0) (CPEN212_STATS builds only)
+static inline void recordBlockChange(void *heap_handle, long n) {
+#ifdef CPEN212_STATS
+    heapStats *stats = &((heapState *)heap_handle)->stats;
+    stats->blocks += (size_t)n;
+    if (n > 0) {
+        stats->splits += (size_t)n;
+    } else {
+        stats->coalesces += (size_t)-n;
+    }
+#else
+    (void)heap_handle;
+    (void)n;
+#endif
+}
+
+//cycle counter reading to time a phase from, or 0 if the heap is not being profiled
+static inline uint64_t startPhase(void *heap_handle) {
+#ifdef CPEN212_PROFILE
+    heapState *state = (heapState *)heap_handle;
+    return state && state->profile ? readCycleCounter() : 0;
+#else
+    (void)heap_handle;
+    return 0;
+#endif
+}
+
+//add the cycles since start to the profile of phase (CPEN212_PROFILE builds only)
+static inline void endPhase(void *heap_handle, profilePhase phase, uint64_t start) {
+#ifdef CPEN212_PROFILE
+    heapState *state = (heapState *)heap_handle;
+    if (state && state->profile) {
+        addProfileSample(&state->profile->cycles[phase], readCycleCounter() - start);
+    }
+#else
+    (void)heap_handle;
+    (void)phase;
+    (void)start;
+#endif
+}
+
+//show an allocation of nbytes at p to the heap sampler if it is due (CPEN212_SAMPLE builds only);
+//always inlined, so the sampler finds the caller right above the cpen212_* frame at any -O level
+static inline __attribute__((always_inline)) void noteAlloc(void *heap_handle, void *p, size_t nbytes) {
+#ifdef CPEN212_SAMPLE
+    heapSampler *sampler = ((heapState *)heap_handle)->sampler;
+    if (sampler && p && (sampler->bytesUntilSample -= (int64_t)nbytes) <= 0) {
+        sampler->onAlloc(sampler, p, nbytes);
+    }
+#else
+    (void)heap_handle;
+    (void)p;
+    (void)nbytes;
+#endif
+}
+
+//tell the heap sampler p is being freed if it may have been sampled (CPEN212_SAMPLE builds only)
+static inline __attribute__((always_inline)) void noteFree(void *heap_handle, void *p) {
+#ifdef CPEN212_SAMPLE
+    heapSampler *sampler = ((heapState *)heap_handle)->sampler;
+    if (sampler && p && sampler->filter[getSampleFilterSlot(p)]) {
+        sampler->onFree(sampler, p, 0);
+    }
+#else
+    (void)heap_handle;
+    (void)p;
+#endif
+}
+
+//put a free block on its size class list (or the large block tree), where the placement policy wants it
+static void insertFreeBlock(void *heap_handle, blockHeader *block) {
+    heapState *state = (heapState *)heap_handle;
+
+    assert(!isBlockAllocated(block));
+    assert(getBlockSize(block) >= MIN_BLOCK_SIZE);
+    recordFreeBlock(heap_handle, getBlockSize(block), true);
+
+#ifndef CPEN212_TLSF
+    if (getBlockSize(block) >= LARGE_BLOCK_SIZE) {
+        insertTreeBlock(state, (treeBlock *)block);
+        return;
+    }
+#endif
+
+    freeBlock *node = (freeBlock *)block;
+    size_t sizeClass = getSizeClass(getBlockSize(block));
+    freeBlock *head = state->freeLists[sizeClass];
+
+    if (!head) {
+        node->next = node;
+        node->prev = node;
+        state->freeLists[sizeClass] = node;
+    } else {
+        //new blocks go in front of successor, which is the head unless the list is address-ordered
+        placementPolicy policy = getHeapPolicy(heap_handle);
+        freeBlock *successor = head;
+        if (policy == POLICY_ADDRESS_ORDERED) {
+            //first block above node, or back at the head if node has the highest address
+            while (successor < node) {
+                successor = successor->next;
+                if (successor == head) {
+                    break;
+                }
+            }
+        }
+        node->next = successor;
+        node->prev = successor->prev;
+        successor->prev->next = node;
+        successor->prev = node;
+
+        //a block in front of the head becomes the head, except with next fit, where the
+        //rover stays put so the new block is the last one the search reaches
+        if (successor == head && policy != POLICY_NEXT_FIT
+            && (policy != POLICY_ADDRESS_ORDERED || node < head)) {
+            state->freeLists[sizeClass] = node;
+        }
+    }
+#ifdef CPEN212_TLSF
+    updateClassBitmaps(state, sizeClass);
+#endif
+}
+
+//unlink a free block from its size class list (or the large block tree)
+static void removeFreeBlock(void *heap_handle, blockHeader *block) {
+    heapState *state = (heapState *)heap_handle;
+
+    assert(!isBlockAllocated(block));
+    recordFreeBlock(heap_handle, getBlockSize(block), false);
+
+#ifndef CPEN212_TLSF
+    if (getBlockSize(block) >= LARGE_BLOCK_SIZE) {
+        removeTreeBlock(state, (treeBlock *)block);
+        return;
+    }
+#endif
+
+    freeBlock *node = (freeBlock *)block;
+    size_t sizeClass = getSizeClass(getBlockSize(block));
+
+    if (node->next == node) {
+        assert(state->freeLists[sizeClass] == node);
+        state->freeLists[sizeClass] = NULL;
+    } else {
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        if (state->freeLists[sizeClass] == node) {
+            state->freeLists[sizeClass] = node->next;
+        }
+    }
+#ifdef CPEN212_TLSF
+    updateClassBitmaps(state, sizeClass);
+#endif
+}
+
+//tell the block after block (or the heap state, if block is last) whether block is allocated
+static void updateNextBlock(void *heap_handle, blockHeader *block) {
+    blockHeader *nextBlock = getNextBlock(block);
+    if ((char *)nextBlock < getHeapEnd(heap_handle)) {
+        setPrevBlockAllocated(nextBlock, isBlockAllocated(block));
+    } else {
+        setLastBlockAllocated(heap_handle, isBlockAllocated(block));
+    }
+}
+
+//shrink an allocated block to totalSize and put the tail on the free lists if it is big enough to be a block;
+//a block just taken off the free lists hands its known-zero bit to the tail, and never keeps it itself
+static void splitBlock(void *heap_handle, blockHeader *block, size_t totalSize) {
+    uint64_t start = startPhase(heap_handle);
+    size_t remainingSize = getBlockSize(block) - totalSize;
+
+    assert(isBlockAllocated(block));
+
+    if (remainingSize >= MIN_BLOCK_SIZE) {
+        //update the block size, keeping the flags
+        setBlockSize(block, totalSize);
+
+        blockHeader *newBlock = getNextBlock(block);
+        newBlock->size = remainingSize | BLOCK_PREV_ALLOCATED | (block->size & BLOCK_KNOWN_ZERO);
+        setBlockFooter(newBlock);
+        updateNextBlock(heap_handle, newBlock);
+        insertFreeBlock(heap_handle, newBlock);
+        recordBlockChange(heap_handle, 1);
+    } else {
+        updateNextBlock(heap_handle, block);
+    }
+    setBlockKnownZero(block, false);
+    endPhase(heap_handle, PHASE_SPLIT, start);
+}
+
+//total block size (header + payload) needed to hold nbytes of user data;
+//allocated blocks have no footer, but must be big enough to take one once freed
+static size_t getTotalSize(size_t nbytes) {
+    size_t alignedSize = (nbytes + 7) & ~7;     //make sure the requested size is 8-byte aligned
+    size_t totalSize = alignedSize + sizeof(blockHeader);
+    return totalSize < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : totalSize;
+}
+
+//first free list that can hold a block of totalSize bytes,
+//or NUM_SIZE_CLASSES if only the large block tree can
+static size_t getFirstSizeClass(size_t totalSize) {
+#ifndef CPEN212_TLSF
+    if (totalSize >= LARGE_BLOCK_SIZE) {
+        return NUM_SIZE_CLASSES;
+    }
+#endif
+    return getSizeClass(totalSize);
+}
+
+//count one free list search that examined scanned free blocks (CPEN212_STATS and CPEN212_PROFILE builds only)
+static inline void recordSearch(void *heap_handle, size_t scanned, bool found) {
+#ifdef CPEN212_PROFILE
+    heapProfile *profile = ((heapState *)heap_handle)->profile;
+    if (profile) {
+        addProfileSample(&profile->blocksVisited, scanned);
+    }
+#endif
+#ifdef CPEN212_STATS
+    heapStats *stats = &((heapState *)heap_handle)->stats;
+    stats->searches++;
+    stats->blocksScanned += scanned;
+    if (scanned > stats->longestScan) {
+        stats->longestScan = scanned;
+    }
+    if (!found) {
+        stats->failedSearches++;
+    }
+#else
+    (void)heap_handle;
+    (void)scanned;
+    (void)found;
+#endif
+}
+
+typedef enum reallocKind {
+    REALLOC_IN_PLACE,
+    REALLOC_SLID,
+    REALLOC_MOVED,
+} reallocKind;
+
+//count one successful realloc of an existing block (CPEN212_STATS builds only)
+static inline void recordRealloc(void *heap_handle, reallocKind kind) {
+#ifdef CPEN212_STATS
+    heapStats *stats = &((heapState *)heap_handle)->stats;
+    if (kind == REALLOC_IN_PLACE) {
+        stats->reallocsInPlace++;
+    } else if (kind == REALLOC_SLID) {
+        stats->reallocsSlid++;
+    } else {
+        stats->reallocsMoved++;
+    }
+#else
+    (void)heap_handle;
+    (void)kind;
+#endif
+}
+
+#ifdef CPEN212_TLSF
+//good fit: round totalSize up to the next list boundary so the head of any non-empty
+//list at or above it fits, then find that list with two count-trailing-zeros
+static blockHeader *findFreeBlock(void *heap_handle, size_t totalSize) {
+    heapState *state = (heapState *)heap_handle;
+
+    size_t searchSize = totalSize;
+    if (totalSize >= TLSF_SMALL_SIZE) {
+        size_t log2Size = (size_t)(63 - __builtin_clzl(totalSize));
+        searchSize += ((size_t)1 << (log2Size - TLSF_SL_LOG2)) - 1;
+    }
+    size_t sizeClass = getSizeClass(searchSize);
+    size_t fl = sizeClass / TLSF_SL_COUNT;
+    size_t sl = sizeClass % TLSF_SL_COUNT;
+
+    if (fl < TLSF_FL_COUNT) {
+        unsigned slMap = state->slBitmap[fl] & (~0u << sl);
+        if (!slMap) {
+            //nothing left in this first level, so take the smallest non-empty larger one
+            uint64_t flMap = state->flBitmap & (~(uint64_t)0 << fl << 1);
+            if (flMap) {
+                fl = (size_t)__builtin_ctzll(flMap);
+                slMap = state->slBitmap[fl];
+            }
+        }
+        if (slMap) {
+            freeBlock *node = state->freeLists[fl * TLSF_SL_COUNT + (size_t)__builtin_ctz(slMap)];
+            assert(node && getBlockSize(&node->header) >= totalSize);
+            recordSearch(heap_handle, 1, true);
+            return &node->header;
+        }
+    }
+
+    //the rounding skips totalSize's own list, which may still hold a block that fits;
+    //only scan it when nothing else can satisfy the request, so the common path stays O(1)
+    size_t scanned = 0;
+    freeBlock *head = state->freeLists[getSizeClass(totalSize)];
+    for (freeBlock *node = head; node; node = getNextFreeBlock(head, node)) {
+        scanned++;
+        if (getBlockSize(&node->header) >= totalSize) {
+            recordSearch(heap_handle, scanned, true);
+            return &node->header;
+        }
+    }
+    recordSearch(heap_handle, scanned, false);
+    return NULL;
+}
+#else
+//search the smallest size class that can hold totalSize, then the larger ones, using the heap's policy;
+//every block in a larger class fits, so the best fit is always in the first class with any fit
+static blockHeader *findFreeBlock(void *heap_handle, size_t totalSize) {
+    heapState *state = (heapState *)heap_handle;
+    placementPolicy policy = getHeapPolicy(heap_handle);
+    blockHeader *found = NULL;
+    size_t scanned = 0;
+
+    for (size_t sizeClass = getFirstSizeClass(totalSize); sizeClass < NUM_SIZE_CLASSES && !found; sizeClass++) {
+        freeBlock *head = state->freeLists[sizeClass];
+        for (freeBlock *node = head; node; node = getNextFreeBlock(head, node)) {
+            scanned++;
+            size_t size = getBlockSize(&node->header);
+            if (size < totalSize) {
+                continue;
+            }
+            if (policy != POLICY_BEST_FIT) {
+                found = &node->header;
+                break;
+            }
+            if (!found || size < getBlockSize(found)) {
+                found = &node->header;
+                if (size == totalSize) {
+                    break; //can't do better than exact
+                }
+            }
+        }
+
+        if (found && policy == POLICY_NEXT_FIT) {
+            //move the rover to the block found, so unlinking it leaves the rover on its successor
+            state->freeLists[sizeClass] = (freeBlock *)found;
+        }
+    }
+
+    //nothing on the lists, so take the best fit among the large blocks
+    if (!found) {
+        treeBlock *node = findTreeBlock(state, totalSize);
+        if (node) {
+            found = &node->header;
+        }
+        scanned++;
+    }
+    recordSearch(heap_handle, scanned, found != NULL);
+    return found;
+}
+#endif
+
+//bytes to skip at the front of a free block so its payload starts on an alignment boundary;
+//the skipped bytes become a free block, so they must be either none or at least MIN_BLOCK_SIZE
+static size_t getAlignedSlack(blockHeader *block, size_t alignment) {
+    uintptr_t payload = (uintptr_t)block + sizeof(blockHeader);
+    uintptr_t aligned = (payload + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    while (aligned != payload && aligned - payload < MIN_BLOCK_SIZE) {
+        aligned += alignment;
+    }
+    return aligned - payload;
+}
+
+//carve an allocated block of at least totalSize bytes whose payload starts on an alignment boundary,
+//giving the leading slack back as a free block
+static blockHeader *allocAlignedBlock(void *heap_handle, size_t alignment, size_t totalSize) {
+    heapState *state = (heapState *)heap_handle;
+    blockHeader *block = NULL;
+
+    for (size_t sizeClass = getFirstSizeClass(totalSize); sizeClass < NUM_SIZE_CLASSES && !block; sizeClass++) {
+        freeBlock *head = state->freeLists[sizeClass];
+        for (freeBlock *node = head; node; node = getNextFreeBlock(head, node)) {
+            if (getAlignedSlack(&node->header, alignment) + totalSize <= getBlockSize(&node->header)) {
+                block = &node->header;
+                break;
+            }
+        }
+    }
+#ifndef CPEN212_TLSF
+    for (treeBlock *node = findTreeBlock(state, totalSize); node && !block; node = getNextTreeBlock(state, node)) {
+        if (getAlignedSlack(&node->header, alignment) + totalSize <= getBlockSize(&node->header)) {
+            block = &node->header;
+        }
+    }
+#endif
+    if (!block) {
+        return NULL;
+    }
+
+    size_t slack = getAlignedSlack(block, alignment);
+    removeFreeBlock(heap_handle, block);
+    if (slack) {
+        //give the leading slack back as its own free block
+        blockHeader *alignedBlock = (blockHeader *)((char *)block + slack);
+        alignedBlock->size = (getBlockSize(block) - slack) | (block->size & BLOCK_KNOWN_ZERO); //follows a free block
+        setBlockSize(block, slack);
+        setBlockFooter(block);
+        insertFreeBlock(heap_handle, block);
+        recordBlockChange(heap_handle, 1);
+        block = alignedBlock;
+    }
+    setBlockAllocated(block, true);
+    splitBlock(heap_handle, block, totalSize);
+    return block;
+}
+
+//general (non-slab) allocation of a block with at least totalSize bytes;
+//if knownZero is not NULL it is set to whether the block came off the lists known to be zero
+static blockHeader *allocBlock(void *heap_handle, size_t totalSize, bool *knownZero) {
+    //only free blocks are on the lists, so this never steps over allocated blocks
+    uint64_t start = startPhase(heap_handle);
+    blockHeader *block = findFreeBlock(heap_handle, totalSize);
+    endPhase(heap_handle, PHASE_SEARCH, start);
+    if (!block) {
+        return NULL; //no sufficient free block found
+    }
+
+    if (knownZero) {
+        *knownZero = isBlockKnownZero(block);
+    }
+    removeFreeBlock(heap_handle, block);
+    setBlockAllocated(block, true);
+    splitBlock(heap_handle, block, totalSize);
+    return block;
+}
+
+//mark an allocated block free, coalesce it with free neighbours and put it on the free lists
+static void releaseBlock(void *heap_handle, blockHeader *block) {
+    uint64_t start = startPhase(heap_handle);
+    assert(isBlockAllocated(block));
+    setBlockAllocated(block, false);    //mark block as free (unallocated)
+
+    //backwards coalescing - the previous block only has a footer to find it by if it is free
+    if (!isPrevBlockAllocated(block)) {
+        blockHeader *prevBlock = getPrevBlock(block);
+        assert(!isBlockAllocated(prevBlock));
+        removeFreeBlock(heap_handle, prevBlock);
+
+        //update previous block's size to include current block
+        setBlockSize(prevBlock, getBlockSize(prevBlock) + getBlockSize(block));
+        recordBlockChange(heap_handle, -1);
+        block = prevBlock; //update block pointer for forward coalescing
+    }
+
+    //forward coalescing - check if next block exists and is free
+    blockHeader *nextBlock = getNextBlock(block);  //get next block
+
+    //check if next block is within heap bounds
+    if ((char *)nextBlock < getHeapEnd(heap_handle)) {
+        //if next block is free merge w current block
+        if (!isBlockAllocated(nextBlock)) {
+            removeFreeBlock(heap_handle, nextBlock);
+
+            //update current block size to include next block
+            setBlockSize(block, getBlockSize(block) + getBlockSize(nextBlock));
+            recordBlockChange(heap_handle, -1);
+        }
+    }
+    //the freed block may have been written, so whatever it merged into is no longer known to be zero
+    setBlockKnownZero(block, false);
+    setBlockFooter(block);  //update footer after coalescing
+    updateNextBlock(heap_handle, block);
+    insertFreeBlock(heap_handle, block);
+    endPhase(heap_handle, PHASE_COALESCE, start);
+}
+
+//slab class for a request of 1..SLAB_MAX_SIZE bytes: 8, 16, 24, 32, 48 or 64 byte slots
+static size_t getSlabClass(size_t nbytes) {
+    if (nbytes <= 32) {
+        return (nbytes + 7) / 8 - 1;
+    }
+    return nbytes <= 48 ? 4 : 5;
+}
+
+static size_t getSlabClassSize(size_t slabClass) {
+    if (slabClass < 4) {
+        return (slabClass + 1) * 8;
+    }
+    return slabClass == 4 ? 48 : 64;
+}
+
+static void pushSlabPage(slabDirectory *dir, size_t slabClass, slabPage *page) {
+    page->prev = NULL;
+    page->next = dir->partial[slabClass];
+    if (page->next) {
+        page->next->prev = page;
+    }
+    dir->partial[slabClass] = page;
+}
+
+static void unlinkSlabPage(slabDirectory *dir, size_t slabClass, slabPage *page) {
+    if (page->prev) {
+        page->prev->next = page->next;
+    } else {
+        assert(dir->partial[slabClass] == page);
+        dir->partial[slabClass] = page->next;
+    }
+    if (page->next) {
+        page->next->prev = page->prev;
+    }
+}
+
+//carve a fresh page aligned to SLAB_PAGE_SIZE out of the general heap
+static slabPage *newSlabPage(void *heap_handle, size_t slotSize) {
+    blockHeader *block = allocAlignedBlock(heap_handle, SLAB_PAGE_SIZE,
+                                           SLAB_PAGE_SIZE + sizeof(blockHeader));
+    if (!block) {
+        return NULL;
+    }
+
+    slabPage *page = (slabPage *)((char *)block + sizeof(blockHeader));
+    assert(((uintptr_t)page & (SLAB_PAGE_SIZE - 1)) == 0);
+    size_t slotCount = getSlabSlotCount(slotSize);
+    assert(slotCount <= SLAB_MAP_WORDS * 64);
+
+    page->magic = SLAB_MAGIC ^ (uintptr_t)page;
+    page->slotSize = (uint32_t)slotSize;
+    page->freeSlots = (uint32_t)slotCount;
+    for (size_t i = 0; i < SLAB_MAP_WORDS; i++) {
+        size_t bits = slotCount > i * 64 ? slotCount - i * 64 : 0;
+        page->freeMap[i] = bits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+    }
+    return page;
+}
+
+//hand out a slot of the slab class for nbytes, or NULL if no page could be made
+static void *slabAlloc(void *heap_handle, size_t nbytes) {
+    heapState *state = (heapState *)heap_handle;
+
+    if (!state->slabs) {
+        blockHeader *dirBlock = allocBlock(heap_handle, getTotalSize(sizeof(slabDirectory)), NULL);
+        if (!dirBlock) {
+            return NULL;
+        }
+        state->slabs = (slabDirectory *)((char *)dirBlock + sizeof(blockHeader));
+        memset(state->slabs, 0, sizeof(slabDirectory));
+    }
+
+    size_t slabClass = getSlabClass(nbytes);
+    slabPage *page = state->slabs->partial[slabClass];
+    if (!page) {
+        page = newSlabPage(heap_handle, getSlabClassSize(slabClass));
+        if (!page) {
+            return NULL;
+        }
+        pushSlabPage(state->slabs, slabClass, page);
+    }
+
+    //take the lowest free slot
+    size_t word = 0;
+    while (!page->freeMap[word]) {
+        word++;
+        assert(word < SLAB_MAP_WORDS);
+    }
+    size_t slot = word * 64 + (size_t)__builtin_ctzll(page->freeMap[word]);
+    page->freeMap[word] &= page->freeMap[word] - 1;
+
+    //full pages leave the partial list until a slot is freed
+    if (--page->freeSlots == 0) {
+        unlinkSlabPage(state->slabs, slabClass, page);
+    }
+    return getSlabSlots(page) + slot * page->slotSize;
+}
+
+static void slabFree(void *heap_handle, slabPage *page, void *p) {
+    slabDirectory *dir = ((heapState *)heap_handle)->slabs;
+    size_t slabClass = getSlabClass(page->slotSize);
+    size_t slot = (size_t)((char *)p - getSlabSlots(page)) / page->slotSize;
+
+    assert(((char *)p - getSlabSlots(page)) % page->slotSize == 0);
+    assert(!(page->freeMap[slot / 64] & ((uint64_t)1 << (slot % 64))));
+    page->freeMap[slot / 64] |= (uint64_t)1 << (slot % 64);
+
+    if (++page->freeSlots == 1) {
+        pushSlabPage(dir, slabClass, page); //was full
+    } else if (page->freeSlots == getSlabSlotCount(page->slotSize) && (page->prev || page->next)) {
+        //empty and not the last page with room in its class, so return it to the heap
+        unlinkSlabPage(dir, slabClass, page);
+        page->magic = 0;
+        releaseBlock(heap_handle, (blockHeader *)((char *)page - sizeof(blockHeader)));
+    }
+}
+
+//carve up to count allocated blocks of totalSize bytes off the front of a free block and
+//store their payloads in out, returning how many were made; the last one takes the rest and is split
+static size_t carveBlocks(void *heap_handle, blockHeader *block, size_t totalSize, size_t count, void **out) {
+    size_t blockSize = getBlockSize(block);
+    if (count > blockSize / totalSize) {
+        count = blockSize / totalSize;
+    }
+    assert(count > 0);
+
+    removeFreeBlock(heap_handle, block);
+    setBlockAllocated(block, true);
+    recordBlockChange(heap_handle, (long)count - 1);
+    for (size_t i = 0; i + 1 < count; i++) {
+        setBlockSize(block, totalSize);
+        out[i] = (char *)block + sizeof(blockHeader);
+
+        //pass the known-zero bit along so splitting the last block can give it to the tail
+        blockHeader *nextBlock = getNextBlock(block);
+        nextBlock->size = (blockSize - (i + 1) * totalSize) | BLOCK_ALLOCATED | BLOCK_PREV_ALLOCATED
+                          | (block->size & BLOCK_KNOWN_ZERO);
+        setBlockKnownZero(block, false);
+        block = nextBlock;
+    }
+    out[count - 1] = (char *)block + sizeof(blockHeader);
+    splitBlock(heap_handle, block, totalSize);
+    return count;
+}
+
+//the block after block if it exists and is free, otherwise NULL
+static blockHeader *getFreeNextBlock(void *heap_handle, blockHeader *block) {
+    blockHeader *nextBlock = getNextBlock(block);
+    if ((char *)nextBlock >= getHeapEnd(heap_handle) || isBlockAllocated(nextBlock)) {
+        return NULL;
+    }
+    return nextBlock;
+}
+
+//copy nbytes (a multiple of 8) from src down to dst < src, which may overlap;
+//each 32-byte chunk is loaded whole before it is stored, and any bytes a store clobbers
+//have already been loaded, so this is safe without memmove's direction check
+static void moveDataDown(void *dst, const void *src, size_t nbytes) {
+    typedef struct { uint64_t words[4]; } chunk;
+    char *to = (char *)dst;
+    const char *from = (const char *)src;
+
+    assert(to <= from && nbytes % 8 == 0);
+
+    size_t i = 0;
+    for (; i + sizeof(chunk) <= nbytes; i += sizeof(chunk)) {
+        chunk c;
+        memcpy(&c, from + i, sizeof(chunk));
+        memcpy(to + i, &c, sizeof(chunk));
+    }
+    for (; i < nbytes; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, from + i, sizeof(uint64_t));
+        memcpy(to + i, &word, sizeof(uint64_t));
+    }
+}
+
+//restore the max-heap property below ptrs[root] for an n-entry heap ordered by address
+static void siftDown(void **ptrs, size_t root, size_t n) {
+    while (2 * root + 1 < n) {
+        size_t child = 2 * root + 1;
+        if (child + 1 < n && (uintptr_t)ptrs[child + 1] > (uintptr_t)ptrs[child]) {
+            child++;
+        }
+        if ((uintptr_t)ptrs[root] >= (uintptr_t)ptrs[child]) {
+            return;
+        }
+        void *tmp = ptrs[root];
+        ptrs[root] = ptrs[child];
+        ptrs[child] = tmp;
+        root = child;
+    }
+}
+
+//sort pointers by address in place; heapsort, since qsort may allocate
+static void sortPointers(void **ptrs, size_t n) {
+    for (size_t i = n / 2; i > 0; i--) {
+        siftDown(ptrs, i - 1, n);
+    }
+    for (size_t end = n; end > 1; end--) {
+        void *tmp = ptrs[0];
+        ptrs[0] = ptrs[end - 1];
+        ptrs[end - 1] = tmp;
+        siftDown(ptrs, 0, end - 1);
+    }
+}
+
 // void *cpen212_init(void *heap_start, void *heap_end) {
 //     *((void **) heap_start) = heap_start + sizeof(void *);
 //     return heap_start;
 // }
 
-void *cpen212_init(void *heap_start, void *heap_end) {
+//set up a heap over [heap_start, heap_end); zeroed says the caller guarantees the range is all zero
+static void *initHeap(void *heap_start, void *heap_end, placementPolicy policy, bool zeroed) {
     if (!heap_start || !heap_end || heap_start >= heap_end) {
         return NULL; //invalid heap boundaries
     }
+    if ((size_t)policy > HEAP_POLICY_MASK) {
+        return NULL; //unknown placement policy
+    }
 
     //store heap size at the beginning of the heap
     size_t heap_size = (size_t)((char *)heap_end - (char *)heap_start);
-    *((size_t *)heap_start) = heap_size;
+    if (heap_size < sizeof(heapState)) {
+        return NULL; //no room for the heap state
+    }
+    assert((heap_size & HEAP_FLAGS_MASK) == 0);
+    heapState *state = (heapState *)heap_start;
+    state->size = heap_size | (size_t)policy | HEAP_LAST_ALLOCATED;
+    for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+        state->freeLists[i] = NULL;
+    }
+#ifndef CPEN212_TLSF
+    state->largeBlocks = NULL;
+#endif
+    state->slabs = NULL;
+#ifdef CPEN212_STATS
+    memset(&state->stats, 0, sizeof(state->stats));
+#endif
+#ifdef CPEN212_PROFILE
+    state->profile = NULL;
+#endif
+#ifdef CPEN212_SAMPLE
+    state->sampler = NULL;
+#endif
+#ifdef CPEN212_TLSF
+    if (heap_size >> TLSF_FL_MAX_LOG2) {
+        return NULL; //blocks this large are outside the index
+    }
+    state->size &= ~HEAP_POLICY_MASK; //TLSF always uses its own good fit
+    state->flBitmap = 0;
+    memset(state->slBitmap, 0, sizeof(state->slBitmap));
+#endif
 
-    //initialize first block (after the heap size)
-    blockHeader *firstBlock = (blockHeader *)((char *)heap_start + sizeof(size_t));
-    firstBlock->size = heap_size - sizeof(size_t);  //size includes header and payload
+    //initialize first block (after the heap state)
+    size_t blockSize = heap_size - sizeof(heapState);
+    if (blockSize == 0) {
+        return heap_start; //empty heap
+    }
+    blockHeader *firstBlock = getFirstBlock(heap_start);
+    firstBlock->size = blockSize | BLOCK_PREV_ALLOCATED;  //size includes header and payload
+#ifdef CPEN212_STATS
+    state->stats.blocks = 1;
+#endif
+    if (blockSize < MIN_BLOCK_SIZE) {
+        //too small to ever be handed out, so keep it out of the free lists
+        setBlockAllocated(firstBlock, true);
+        return heap_start;
+    }
     setBlockAllocated(firstBlock, false);
+    setBlockKnownZero(firstBlock, zeroed);
     setBlockFooter(firstBlock); //set footer for first block
+    updateNextBlock(heap_start, firstBlock);
+    insertFreeBlock(heap_start, firstBlock);
 
     return heap_start; //return start of heap
 }
 
+void *cpen212_init(void *heap_start, void *heap_end) {
+    return cpen212_init_policy(heap_start, heap_end, POLICY_FIRST_FIT);
+}
+
+void *cpen212_init_policy(void *heap_start, void *heap_end, placementPolicy policy) {
+    return initHeap(heap_start, heap_end, policy, false);
+}
+
+void *cpen212_init_zeroed(void *heap_start, void *heap_end, placementPolicy policy) {
+    return initHeap(heap_start, heap_end, policy, true);
+}
+
 // this alloc is broken: it blithely allocates past the end of the heap
 // void *cpen212_alloc(void *heap_handle, size_t nbytes) {
 //     size_t aligned_sz = (nbytes + 7) & ~7;
@@ -59,216 +1016,515 @@ void *cpen212_init(void *heap_start, void *heap_end) {
 //     *((void **) heap_handle) += aligned_sz;
 //     return p;
 // }
-void *cpen212_alloc(void *heap_handle, size_t nbytes) {
-    if (!heap_handle || nbytes == 0) {
-        return NULL;
-    }
-
-    //retrieve heap size (stored at the beginning of the heap)
-    size_t heap_size = *((size_t *)heap_handle);
+//allocRequest for a regular block, never a slab slot; nbytes must already be validated
+static void *allocRegularRequest(void *heap_handle, size_t nbytes) {
+    //calculate total size needed (payload + header)
+    size_t totalSize = getTotalSize(nbytes);
 
-    //start from first block (after the heap size)
-    blockHeader *current = (blockHeader *)((char *)heap_handle + sizeof(size_t));
+    blockHeader *current = allocBlock(heap_handle, totalSize, NULL);
+    if (!current) {
+        return NULL; //no sufficient free block found
+    }
 
-    //make sure the requested size is 8-byte aligned
-    size_t alignedSize = (nbytes + 7) & ~7;
+    //return address of the usable space (after the block header)
+    return (void *)((char *)current + sizeof(blockHeader));
+}
 
-    //calculate total size needed (payload + header)
-    size_t totalSize = alignedSize + sizeof(blockHeader) + sizeof(size_t); //add size for footer
-
-    //traverse heap linearly
-    while ((char *)current < (char *)heap_handle + heap_size) {
-        if (!isBlockAllocated(current) && getBlockSize(current) >= totalSize) {
-            size_t remainingSize = getBlockSize(current) - totalSize;
-
-            //check if remaining space is big enough to create new block
-            if (remainingSize >= sizeof(blockHeader) + sizeof(size_t)) {
-                //splitting
-                blockHeader *newBlock = (blockHeader *)((char *)current + totalSize);
-                newBlock->size = remainingSize;
-                setBlockAllocated(newBlock, false);
-                setBlockFooter(newBlock);
-
-                //update the current block's size
-                current->size = totalSize;
-            } else {
-                //if remaining space is too small use entire block
-                totalSize = getBlockSize(current);
-            }
+//cpen212_alloc without the profiling, so calls made by realloc are not counted twice
+static void *allocRequest(void *heap_handle, size_t nbytes) {
+    if (!heap_handle || nbytes == 0 || nbytes > getHeapSize(heap_handle)) {
+        return NULL;
+    }
 
-            //set current block as allocated
-            setBlockAllocated(current, true);
-            setBlockFooter(current);
-            //return address of the usable space (after the block header)
-            return (void *)((char *)current + sizeof(blockHeader));
+    //small requests come from slab pages when the heap is large enough to afford them
+    if (nbytes <= SLAB_MAX_SIZE && getHeapSize(heap_handle) >= SLAB_MIN_HEAP_SIZE) {
+        void *p = slabAlloc(heap_handle, nbytes);
+        if (p) {
+            return p;
         }
-
-        //move to next block
-        current = (blockHeader *)((char *)current + getBlockSize(current));
     }
 
-    //no sufficient free block found
-    return NULL;
+    return allocRegularRequest(heap_handle, nbytes);
 }
 
-void cpen212_free(void *heap_handle, void *p) {
+//cpen212_free without the profiling
+static void freeRequest(void *heap_handle, void *p) {
     //validate input parameters
     if (!heap_handle || !p) {
         return;
     }
 
+    slabPage *page = getSlabPage(heap_handle, p);
+    if (page) {
+        slabFree(heap_handle, page, p);
+        return;
+    }
+
     //get block header by moving back sizeof(blockHeader) bytes from user pointer
     blockHeader *block = (blockHeader *)((char *)p - sizeof(blockHeader));
-    setBlockAllocated(block, false);    //mark block as free (unallocated)
+    releaseBlock(heap_handle, block);
+}
 
-    //get heap size for boundary checking
-    size_t heap_size = getHeapSize(heap_handle);
+//reallocRequest for prev in a regular block; a moved block goes to a slab slot only if useSlabs
+static void *reallocRegularRequest(void *heap_handle, void *prev, size_t nbytes, bool useSlabs) {
+    //get old block header and its size
+    blockHeader *oldBlock = (blockHeader *)((char *)prev - sizeof(blockHeader));
+    size_t oldSize = getBlockSize(oldBlock) - sizeof(blockHeader);
+
+    //calc new total size needed (payload + header)
+    size_t totalSize = getTotalSize(nbytes);
+    size_t currentSize = getBlockSize(oldBlock);
+
+    //the free neighbours the block could grow into (or give its tail to)
+    blockHeader *nextBlock = getFreeNextBlock(heap_handle, oldBlock);
+    size_t nextSize = nextBlock ? getBlockSize(nextBlock) : 0;
+    blockHeader *prevBlock = isPrevBlockAllocated(oldBlock) ? NULL : getPrevBlock(oldBlock);
+    size_t prevSize = prevBlock ? getBlockSize(prevBlock) : 0;
 
-    //backwards coalescing - check if previous block exists and is free
-    if ((char *)block > (char *)heap_handle + sizeof(size_t)) {
-        //get previous block's footer
-        size_t *prevFooter = (size_t *)((char *)block - sizeof(size_t));
-        
-        //if previous block exists and is free
-        if (!(*prevFooter & BLOCK_ALLOCATED)) {
-            size_t prevSize = *prevFooter & BLOCK_SIZE_MASK;
-            blockHeader *prevBlock = (blockHeader *)((char *)block - prevSize);
-            
-            //update previous block's size to include current block
-            prevBlock->size = getBlockSize(prevBlock) + getBlockSize(block);
-            block = prevBlock; //update block pointer for forward coalescing
+    //shrink, or grow forward into a free successor: the data stays put;
+    //when shrinking, absorbing the free successor first lets the released tail merge with it
+    if (totalSize <= currentSize + nextSize) {
+        if (nextBlock) {
+            removeFreeBlock(heap_handle, nextBlock);
+            setBlockSize(oldBlock, currentSize + nextSize);
+            recordBlockChange(heap_handle, -1);
         }
+        splitBlock(heap_handle, oldBlock, totalSize);
+        recordRealloc(heap_handle, REALLOC_IN_PLACE);
+        return prev; //return same pointer
     }
 
-    //forward coalescing - check if next block exists and is free
-    blockHeader *nextBlock = (blockHeader *)((char *)block + getBlockSize(block));  //get next block
-    
-    //check if next block is within heap bounds
-    if ((char *)nextBlock < (char *)heap_handle + heap_size) {
-        //if next block is free merge w current block
-        if (!isBlockAllocated(nextBlock)) {
-            //update current block size to include next block
-            block->size = getBlockSize(block) + getBlockSize(nextBlock);
-            
+    //grow backward into a free predecessor (and the free successor, if any, so the
+    //tail split off below is one free block rather than two adjacent ones)
+    if (prevBlock && totalSize <= prevSize + currentSize + nextSize) {
+        removeFreeBlock(heap_handle, prevBlock);
+        if (nextBlock) {
+            removeFreeBlock(heap_handle, nextBlock);
         }
+        setBlockSize(prevBlock, prevSize + currentSize + nextSize);
+        recordBlockChange(heap_handle, nextBlock ? -2 : -1);
+        setBlockAllocated(prevBlock, true);
+        setBlockKnownZero(prevBlock, false); //about to hold the old block's data
+
+        //slide the data down before splitting, since the tail's header may land on it
+        void *newPayload = (char *)prevBlock + sizeof(blockHeader);
+        uint64_t start = startPhase(heap_handle);
+        moveDataDown(newPayload, prev, oldSize);
+        endPhase(heap_handle, PHASE_COPY, start);
+        splitBlock(heap_handle, prevBlock, totalSize);
+        recordRealloc(heap_handle, REALLOC_SLID);
+        return newPayload;
     }
-    setBlockFooter(block);  //update footer after coalescing
+
+    //allocate new block of requested size
+    void *newBlock = useSlabs ? allocRequest(heap_handle, nbytes) : allocRegularRequest(heap_handle, nbytes);
+    if (!newBlock) {
+        return NULL;    //allocation failed
+    }
+
+    //copy data from old block to new block
+    //use smaller of old and new sizes to prevent buffer overflow
+    size_t copySize = (oldSize < nbytes) ? oldSize : nbytes;
+    uint64_t start = startPhase(heap_handle);
+    memcpy(newBlock, prev, copySize);
+    endPhase(heap_handle, PHASE_COPY, start);
+
+    //free the old block
+    releaseBlock(heap_handle, oldBlock);
+    recordRealloc(heap_handle, REALLOC_MOVED);
+
+    return newBlock;    //return pointer to new block
 }
 
-void *cpen212_realloc(void *heap_handle, void *prev, size_t nbytes) {
+//cpen212_realloc without the profiling
+static void *reallocRequest(void *heap_handle, void *prev, size_t nbytes) {
     if (!heap_handle) { //validate heap handle
-        return NULL;    
+        return NULL;
     }
 
     //if prev == NULL treat as new allocation
     if (!prev) {
-        return cpen212_alloc(heap_handle, nbytes);
+        return allocRequest(heap_handle, nbytes);
+    }
+    if (nbytes > getHeapSize(heap_handle)) {
+        return NULL;    //can never fit
     }
 
-    //get old block header and its size
-    blockHeader *oldBlock = (blockHeader *)((char *)prev - sizeof(blockHeader));
-    size_t oldSize = getBlockSize(oldBlock) - sizeof(blockHeader) - sizeof(size_t);
-
-    //calc new total size needed (payload + header + footer)
-    size_t alignedSize = (nbytes + 7) & ~7; //ensure 8-byte alignment
-    size_t totalSize = alignedSize + sizeof(blockHeader) + sizeof(size_t);
+    //slab slots cannot grow, so anything past the slot size moves to a new allocation
+    slabPage *page = getSlabPage(heap_handle, prev);
+    if (page) {
+        if (nbytes <= page->slotSize) {
+            recordRealloc(heap_handle, REALLOC_IN_PLACE);
+            return prev;
+        }
+        void *newBlock = allocRequest(heap_handle, nbytes);
+        if (!newBlock) {
+            return NULL;
+        }
+        uint64_t start = startPhase(heap_handle);
+        memcpy(newBlock, prev, page->slotSize);
+        endPhase(heap_handle, PHASE_COPY, start);
+        slabFree(heap_handle, page, prev);
+        recordRealloc(heap_handle, REALLOC_MOVED);
+        return newBlock;
+    }
+    return reallocRegularRequest(heap_handle, prev, nbytes, true);
+}
 
-    //check if block can be resized
-    size_t currentSize = getBlockSize(oldBlock);
-    if (totalSize <= currentSize) {
-        //shrink block in place
-        size_t remainingSize = currentSize - totalSize;
+void *cpen212_alloc(void *heap_handle, size_t nbytes) {
+    uint64_t start = startPhase(heap_handle);
+    void *p = allocRequest(heap_handle, nbytes);
+    endPhase(heap_handle, PHASE_ALLOC, start);
+    if (p) {
+        noteAlloc(heap_handle, p, nbytes);
+    }
+    return p;
+}
 
-        if (remainingSize >= sizeof(blockHeader) + sizeof(size_t)) {
-            //split block
-            blockHeader *newBlock = (blockHeader *)((char *)oldBlock + totalSize);
-            newBlock->size = remainingSize;
-            setBlockAllocated(newBlock, false);
-            setBlockFooter(newBlock);
+void cpen212_free(void *heap_handle, void *p) {
+    if (heap_handle && p) {
+        noteFree(heap_handle, p);
+    }
+    uint64_t start = startPhase(heap_handle);
+    freeRequest(heap_handle, p);
+    endPhase(heap_handle, PHASE_FREE, start);
+}
 
-            //update the old block size
-            oldBlock->size = totalSize;
-            setBlockFooter(oldBlock);
+void *cpen212_realloc(void *heap_handle, void *prev, size_t nbytes) {
+    uint64_t start = startPhase(heap_handle);
+    void *p = reallocRequest(heap_handle, prev, nbytes);
+    endPhase(heap_handle, PHASE_REALLOC, start);
+    if (p) {
+        //to the sampler, a realloc frees the old block and allocates a new one
+        if (prev) {
+            noteFree(heap_handle, prev);
         }
+        noteAlloc(heap_handle, p, nbytes);
+    }
+    return p;
+}
 
-        return prev; //return same pointer
+void *cpen212_alloc_slot(void *heap_handle, size_t nbytes) {
+    if (!heap_handle || nbytes == 0 || nbytes > SLAB_MAX_SIZE || getHeapSize(heap_handle) < SLAB_MIN_HEAP_SIZE) {
+        return NULL;
     }
+    uint64_t start = startPhase(heap_handle);
+    void *p = slabAlloc(heap_handle, nbytes);
+    endPhase(heap_handle, PHASE_ALLOC, start);
+    if (p) {
+        noteAlloc(heap_handle, p, nbytes);
+    }
+    return p;
+}
 
-    //try to extend the block in place by coalescing with neighboring blocks
-    blockHeader *nextBlock = (blockHeader *)((char *)oldBlock + getBlockSize(oldBlock));
-    size_t heap_size = getHeapSize(heap_handle);
+void *cpen212_alloc_block(void *heap_handle, size_t nbytes) {
+    if (!heap_handle || nbytes == 0 || nbytes > getHeapSize(heap_handle)) {
+        return NULL;
+    }
+    uint64_t start = startPhase(heap_handle);
+    void *p = allocRegularRequest(heap_handle, nbytes);
+    endPhase(heap_handle, PHASE_ALLOC, start);
+    if (p) {
+        noteAlloc(heap_handle, p, nbytes);
+    }
+    return p;
+}
 
-    //forward coalescing: check if next block is free and can merge
-    if ((char *)nextBlock < (char *)heap_handle + heap_size && !isBlockAllocated(nextBlock)) {
-        size_t combinedSize = getBlockSize(oldBlock) + getBlockSize(nextBlock);
+void *cpen212_realloc_block(void *heap_handle, void *prev, size_t nbytes) {
+    if (!heap_handle || nbytes > getHeapSize(heap_handle) || (!prev && nbytes == 0)) {
+        return NULL;
+    }
+    uint64_t start = startPhase(heap_handle);
+    void *p = prev ? reallocRegularRequest(heap_handle, prev, nbytes, false) : allocRegularRequest(heap_handle, nbytes);
+    endPhase(heap_handle, PHASE_REALLOC, start);
+    if (p) {
+        if (prev) {
+            noteFree(heap_handle, prev);
+        }
+        noteAlloc(heap_handle, p, nbytes);
+    }
+    return p;
+}
 
-        if (combinedSize >= totalSize) {
-            //merge with next block
-            oldBlock->size = combinedSize;
-            setBlockFooter(oldBlock);
+void cpen212_free_block(void *heap_handle, void *p) {
+    if (!heap_handle || !p) {
+        return;
+    }
+    noteFree(heap_handle, p);
+    uint64_t start = startPhase(heap_handle);
+    releaseBlock(heap_handle, (blockHeader *)((char *)p - sizeof(blockHeader)));
+    endPhase(heap_handle, PHASE_FREE, start);
+}
 
-            //if remaining space split the block
-            size_t remainingSize = combinedSize - totalSize;
-            if (remainingSize >= sizeof(blockHeader) + sizeof(size_t)) {
-                blockHeader *newBlock = (blockHeader *)((char *)oldBlock + totalSize);
-                newBlock->size = remainingSize;
-                setBlockAllocated(newBlock, false);
-                setBlockFooter(newBlock);
+size_t cpen212_alloc_batch(void *heap_handle, size_t nbytes, size_t n, void **out) {
+    if (!heap_handle || !out || nbytes == 0 || nbytes > getHeapSize(heap_handle)) {
+        return 0;
+    }
 
-                //update old block size
-                oldBlock->size = totalSize;
-                setBlockFooter(oldBlock);
+    size_t done = 0;
+    if (nbytes <= SLAB_MAX_SIZE && getHeapSize(heap_handle) >= SLAB_MIN_HEAP_SIZE) {
+        while (done < n) {
+            void *p = slabAlloc(heap_handle, nbytes);
+            if (!p) {
+                break; //no room for another page, so fall back to regular blocks
             }
+            out[done++] = p;
+        }
+    }
+
+    size_t totalSize = getTotalSize(nbytes);
+    while (done < n) {
+        size_t remaining = n - done;
+        blockHeader *block = NULL;
 
-            return prev; //retrun same pointer
+        //look for one extent that holds the rest of the batch before settling for any fit
+        if (remaining > 1 && remaining <= getHeapSize(heap_handle) / totalSize) {
+            block = findFreeBlock(heap_handle, remaining * totalSize);
         }
+        if (!block) {
+            block = findFreeBlock(heap_handle, totalSize);
+        }
+        if (!block) {
+            break; //heap is full
+        }
+        done += carveBlocks(heap_handle, block, totalSize, remaining, out + done);
+    }
+    for (size_t i = 0; i < done; i++) {
+        noteAlloc(heap_handle, out[i], nbytes);
     }
+    return done;
+}
 
-    //backward coalescing: check if previous block is free and can be merged
-    if ((char *)oldBlock > (char *)heap_handle + sizeof(size_t)) {
-        size_t *prevFooter = (size_t *)((char *)oldBlock - sizeof(size_t));
-        if (!(*prevFooter & BLOCK_ALLOCATED)) {
-            size_t prevSize = *prevFooter & BLOCK_SIZE_MASK;
-            blockHeader *prevBlock = (blockHeader *)((char *)oldBlock - prevSize);
+void cpen212_free_batch(void *heap_handle, void **ptrs, size_t n) {
+    if (!heap_handle || !ptrs) {
+        return;
+    }
 
-            size_t combinedSize = getBlockSize(prevBlock) + getBlockSize(oldBlock);
+    for (size_t i = 0; i < n; i++) {
+        noteFree(heap_handle, ptrs[i]);
+    }
 
-            if (combinedSize >= totalSize) {
-                //merge w previous block
-                prevBlock->size = combinedSize;
-                setBlockFooter(prevBlock);
+    //in address order, blocks that are next to each other in the heap are next to each other in ptrs
+    sortPointers(ptrs, n);
 
-                //if remaining space split the block
-                size_t remainingSize = combinedSize - totalSize;
-                if (remainingSize >= sizeof(blockHeader) + sizeof(size_t)) {
-                    blockHeader *newBlock = (blockHeader *)((char *)prevBlock + totalSize);
-                    newBlock->size = remainingSize;
-                    setBlockAllocated(newBlock, false);
-                    setBlockFooter(newBlock);
+    size_t i = 0;
+    while (i < n) {
+        void *p = ptrs[i++];
+        if (!p) {
+            continue;
+        }
 
-                    //update prev block size
-                    prevBlock->size = totalSize;
-                    setBlockFooter(prevBlock);
-                }
+        slabPage *page = getSlabPage(heap_handle, p);
+        if (page) {
+            slabFree(heap_handle, page, p);
+            continue;
+        }
 
-                return (void *)((char *)prevBlock + sizeof(blockHeader)); //return new pointer
-            }
+        //fold every following pointer that names the very next block into this one,
+        //so the whole run is coalesced with its free neighbours once
+        blockHeader *block = (blockHeader *)((char *)p - sizeof(blockHeader));
+        size_t runSize = getBlockSize(block);
+        while (i < n && (char *)ptrs[i] == (char *)block + runSize + sizeof(blockHeader)) {
+            runSize += getBlockSize((blockHeader *)((char *)ptrs[i] - sizeof(blockHeader)));
+            recordBlockChange(heap_handle, -1);
+            i++;
         }
+        setBlockSize(block, runSize);
+        releaseBlock(heap_handle, block);
     }
+}
 
-    //allocate new block of requested size
-    void *newBlock = cpen212_alloc(heap_handle, nbytes);
-    if (!newBlock) {
-        return NULL;    //allocation failed
+void *cpen212_memalign(void *heap_handle, size_t alignment, size_t nbytes) {
+    if (!heap_handle || nbytes == 0 || nbytes > getHeapSize(heap_handle)) {
+        return NULL;
     }
+    if (alignment == 0 || (alignment & (alignment - 1)) || alignment > getHeapSize(heap_handle)) {
+        return NULL; //not a power of two, or could never fit
+    }
+    void *p;
+    if (alignment <= 8) {
+        p = allocRequest(heap_handle, nbytes); //every payload is 8-byte aligned
+    } else {
+        //slab slots are only 8-byte aligned, so aligned requests always take a regular block
+        blockHeader *block = allocAlignedBlock(heap_handle, alignment, getTotalSize(nbytes));
+        p = block ? (char *)block + sizeof(blockHeader) : NULL;
+    }
+    if (p) {
+        noteAlloc(heap_handle, p, nbytes);
+    }
+    return p;
+}
 
-    //copy data from old block to new block
-    //use smaller of old and new sizes to prevent buffer overflow
-    size_t copySize = (oldSize < nbytes) ? oldSize : nbytes;
-    memcpy(newBlock, prev, copySize);
+//cpen212_calloc without the sampling
+static void *callocRequest(void *heap_handle, size_t n, size_t size) {
+    size_t nbytes;
+    if (!heap_handle || __builtin_mul_overflow(n, size, &nbytes)
+        || nbytes == 0 || nbytes > getHeapSize(heap_handle)) {
+        return NULL;
+    }
 
-    //free the old block
-    cpen212_free(heap_handle, prev);
+    //slab slots are reused without tracking, so they are always cleared
+    if (nbytes <= SLAB_MAX_SIZE && getHeapSize(heap_handle) >= SLAB_MIN_HEAP_SIZE) {
+        void *p = slabAlloc(heap_handle, nbytes);
+        if (p) {
+            memset(p, 0, nbytes);
+            return p;
+        }
+    }
+
+    bool knownZero;
+    blockHeader *block = allocBlock(heap_handle, getTotalSize(nbytes), &knownZero);
+    if (!block) {
+        return NULL;
+    }
+
+    char *p = (char *)block + sizeof(blockHeader);
+    if (!knownZero) {
+        memset(p, 0, nbytes);
+        return p;
+    }
+
+    //only the free list links and (if the block was not split) the old footer were ever written
+    size_t blockSize = getBlockSize(block);
+    memset(p, 0, sizeof(freeBlock) - sizeof(blockHeader));
+    memset((char *)block + blockSize - sizeof(size_t), 0, sizeof(size_t));
+    return p;
+}
+
+void *cpen212_calloc(void *heap_handle, size_t n, size_t size) {
+    void *p = callocRequest(heap_handle, n, size);
+    if (p) {
+        noteAlloc(heap_handle, p, n * size); //callocRequest made sure this does not overflow
+    }
+    return p;
+}
+
+size_t cpen212_usable_size(void *heap_handle, void *p) {
+    if (!heap_handle || !p) {
+        return 0;
+    }
+    return getUsableSize(heap_handle, p);
+}
+
+size_t cpen212_try_expand(void *heap_handle, void *p, size_t min, size_t preferred) {
+    if (!heap_handle || !p) {
+        return 0;
+    }
+    size_t heapSize = getHeapSize(heap_handle);
+    if (preferred < min) {
+        preferred = min;
+    }
+    if (preferred > heapSize) {
+        preferred = heapSize; //nothing bigger could ever fit, and this keeps getTotalSize from overflowing
+    }
+
+    size_t usable = getUsableSize(heap_handle, p);
+    if (usable >= preferred) {
+        return usable; //never shrinks
+    }
+
+    //slab slots have a fixed size, so only regular blocks with a free successor can grow
+    blockHeader *block = (blockHeader *)((char *)p - sizeof(blockHeader));
+    blockHeader *nextBlock = NULL;
+    if (!getSlabPage(heap_handle, p) && min <= heapSize) {
+        nextBlock = getFreeNextBlock(heap_handle, block);
+    }
+    if (!nextBlock) {
+        return usable >= min ? usable : 0;
+    }
+
+    size_t availableSize = getBlockSize(block) + getBlockSize(nextBlock);
+    size_t totalSize = getTotalSize(preferred);
+    if (totalSize > availableSize) {
+        if (getTotalSize(min) > availableSize) {
+            return usable >= min ? usable : 0; //not worth taking the successor
+        }
+        totalSize = availableSize;
+    }
+
+    removeFreeBlock(heap_handle, nextBlock);
+    setBlockSize(block, availableSize);
+    recordBlockChange(heap_handle, -1);
+    splitBlock(heap_handle, block, totalSize);
+    return getBlockSize(block) - sizeof(blockHeader);
+}
+
+bool cpen212_extend(void *heap_handle, void *new_end) {
+    if (!heap_handle || !new_end || ((uintptr_t)new_end & 7)) {
+        return false;
+    }
+    char *oldEnd = getHeapEnd(heap_handle);
+    if ((char *)new_end < oldEnd + MIN_BLOCK_SIZE) {
+        return false; //too little to make a block of, or not past the end at all
+    }
+    size_t addedSize = (size_t)((char *)new_end - oldEnd);
+#ifdef CPEN212_TLSF
+    if ((getHeapSize(heap_handle) + addedSize) >> TLSF_FL_MAX_LOG2) {
+        return false; //blocks this large are outside the index
+    }
+#endif
+
+    heapState *state = (heapState *)heap_handle;
+    state->size += addedSize; //a multiple of 8, so the flags are untouched
+
+    blockHeader *block;
+    if (!isLastBlockAllocated(heap_handle)) {
+        //the last block is free, so its footer sits right before the old end
+        block = getPrevBlock((blockHeader *)oldEnd);
+        removeFreeBlock(heap_handle, block);
+        setBlockSize(block, getBlockSize(block) + addedSize);
+        setBlockKnownZero(block, false);
+    } else {
+        block = (blockHeader *)oldEnd;
+        block->size = addedSize | BLOCK_PREV_ALLOCATED;
+#ifdef CPEN212_STATS
+        state->stats.blocks++; //a new block, not a split
+#endif
+    }
+    setBlockFooter(block);
+    updateNextBlock(heap_handle, block);
+    insertFreeBlock(heap_handle, block);
+    return true;
+}
+
+//purge the page-aligned interior of a free block, unless that was already done since it last changed
+static size_t purgeBlock(blockHeader *block, size_t pageSize, purgeCallback purge, void *ctx) {
+    size_t *footer = getBlockFooter(block);
+    if (*footer & FOOTER_PURGED) {
+        return 0;
+    }
+
+    uintptr_t start = ((uintptr_t)block + sizeof(freeBlock) + pageSize - 1) & ~(uintptr_t)(pageSize - 1);
+    uintptr_t end = (uintptr_t)footer & ~(uintptr_t)(pageSize - 1);
+    if (end <= start) {
+        return 0; //no whole page clear of the header, links and footer
+    }
+    purge(ctx, (void *)start, end - start);
+    *footer |= FOOTER_PURGED;
+    return end - start;
+}
+
+size_t cpen212_purge(void *heap_handle, size_t pageSize, purgeCallback purge, void *ctx) {
+    if (!heap_handle || !purge || pageSize == 0 || (pageSize & (pageSize - 1))) {
+        return 0;
+    }
+
+    //a block needs at least this much to have a whole page between its links and footer
+    size_t minSize = pageSize + MIN_BLOCK_SIZE;
+    heapState *state = (heapState *)heap_handle;
+    size_t purged = 0;
+
+    for (size_t sizeClass = getFirstSizeClass(minSize); sizeClass < NUM_SIZE_CLASSES; sizeClass++) {
+        freeBlock *head = state->freeLists[sizeClass];
+        for (freeBlock *node = head; node; node = getNextFreeBlock(head, node)) {
+            purged += purgeBlock(&node->header, pageSize, purge, ctx);
+        }
+    }
+#ifndef CPEN212_TLSF
+    for (treeBlock *node = findTreeBlock(state, minSize); node; node = getNextTreeBlock(state, node)) {
+        purged += purgeBlock(&node->header, pageSize, purge, ctx);
+    }
+#endif
+    return purged;
+}
 
-    return newBlock;    //return pointer to new block
-}
\ No newline at end of file
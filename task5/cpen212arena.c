@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "cpen212alloc.h"
+#include "cpen212common.h"
+#include "cpen212arena.h"
+
+/*
+Arena Layout:
+
+reservation (reserved bytes, PROT_NONE until committed)
+    -mmapArena struct <--base
+    -heap (cpen212_init_zeroed over the committed part, since fresh anonymous pages are zero)
+    -committed pages end at base + committed; the heap always ends there too
+    -the rest of the reservation is address space only
+
+Growing commits at least as much as is already committed (so the number of
+grows is logarithmic in the final size), clamped to what is left of the reservation.
+
+Purging hands the interior pages of large free blocks back with madvise (see cpen212_purge).
+cpen212_arena_free counts the bytes it frees and purges once they reach 1/ARENA_PURGE_FRACTION
+of the committed size, so the madvise calls are spread over at least that much freeing.
+*/
+
+#define ARENA_PURGE_FRACTION 8
+#define ARENA_PURGE_ADVICE   MADV_DONTNEED // drops RSS right away; MADV_FREE would defer it to memory pressure
+
+struct mmapArena {
+    char *base;         // start of the reservation (this struct lives here)
+    size_t reserved;    // bytes reserved from base
+    size_t committed;   // bytes readable and writable from base
+    size_t freedBytes;  // bytes freed through cpen212_arena_free since the last purge
+    void *heap;         // heap handle, just past this struct
+};
+
+static size_t roundUpToPage(size_t nbytes) {
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return (nbytes + pageSize - 1) & ~(pageSize - 1);
+}
+
+mmapArena *cpen212_arena_create(size_t reserve, size_t initial, placementPolicy policy) {
+    reserve = roundUpToPage(reserve);
+    initial = roundUpToPage(initial > sizeof(mmapArena) ? initial : sizeof(mmapArena));
+    if (reserve == 0 || initial > reserve) {
+        return NULL;
+    }
+
+    char *base = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(base, initial, PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, reserve);
+        return NULL;
+    }
+
+    mmapArena *arena = (mmapArena *)base;
+    arena->base = base;
+    arena->reserved = reserve;
+    arena->committed = initial;
+    arena->freedBytes = 0;
+
+    char *heapStart = base + ((sizeof(mmapArena) + 7) & ~(size_t)7);
+    arena->heap = cpen212_init_zeroed(heapStart, base + initial, policy);
+    if (!arena->heap) {
+        munmap(base, reserve);
+        return NULL;
+    }
+    return arena;
+}
+
+void cpen212_arena_destroy(mmapArena *arena) {
+    if (arena) {
+        munmap(arena->base, arena->reserved);
+    }
+}
+
+void *cpen212_arena_heap(mmapArena *arena) {
+    return arena->heap;
+}
+
+bool cpen212_arena_grow(mmapArena *arena, size_t nbytes) {
+    size_t available = arena->reserved - arena->committed;
+    if (nbytes > available) {
+        return false;
+    }
+    size_t needed = roundUpToPage(nbytes);
+    size_t growth = needed > arena->committed ? needed : arena->committed;
+    if (growth > available) {
+        growth = available; //still at least needed, since available is a whole number of pages
+    }
+    if (growth == 0) {
+        return false;
+    }
+
+    char *oldEnd = arena->base + arena->committed;
+    if (mprotect(oldEnd, growth, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    if (!cpen212_extend(arena->heap, oldEnd + growth)) {
+        return false; //the pages stay committed, but the heap cannot use them
+    }
+    arena->committed += growth;
+    return true;
+}
+
+//the heap needs at most this much more than nbytes to fit a block of nbytes, however its tail looks
+static size_t getGrowthFor(size_t nbytes) {
+    return nbytes + MIN_BLOCK_SIZE;
+}
+
+void *cpen212_arena_alloc(mmapArena *arena, size_t nbytes) {
+    void *p = cpen212_alloc(arena->heap, nbytes);
+    if (!p && nbytes > 0 && nbytes < arena->reserved && cpen212_arena_grow(arena, getGrowthFor(nbytes))) {
+        p = cpen212_alloc(arena->heap, nbytes);
+    }
+    return p;
+}
+
+void *cpen212_arena_realloc(mmapArena *arena, void *prev, size_t nbytes) {
+    void *p = cpen212_realloc(arena->heap, prev, nbytes);
+    if (!p && nbytes > 0 && nbytes < arena->reserved && cpen212_arena_grow(arena, getGrowthFor(nbytes))) {
+        p = cpen212_realloc(arena->heap, prev, nbytes);
+    }
+    return p;
+}
+
+static void releasePages(void *ctx, void *start, size_t length) {
+    (void)ctx;
+    madvise(start, length, ARENA_PURGE_ADVICE);
+}
+
+size_t cpen212_arena_purge(mmapArena *arena) {
+    arena->freedBytes = 0;
+    return cpen212_purge(arena->heap, (size_t)sysconf(_SC_PAGESIZE), releasePages, NULL);
+}
+
+void cpen212_arena_free(mmapArena *arena, void *p) {
+    if (!p) {
+        return;
+    }
+    arena->freedBytes += cpen212_usable_size(arena->heap, p);
+    cpen212_free(arena->heap, p);
+    if (arena->freedBytes >= arena->committed / ARENA_PURGE_FRACTION) {
+        cpen212_arena_purge(arena);
+    }
+}
+
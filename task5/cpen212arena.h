@@ -0,0 +1,63 @@
+#ifndef __CPEN212ARENA_H__
+#define __CPEN212ARENA_H__
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "cpen212common.h"
+
+// Growable cpen212 heap backed by an mmap reservation (Linux).
+//
+// The arena reserves a large range of address space up front without committing
+// any memory, starts the heap over the first few pages, and commits more pages
+// (growing the heap with cpen212_extend) whenever an allocation does not fit.
+// Only the committed part ever counts towards the process's memory use, and
+// the pages inside large free blocks can be handed back to the OS again (purged).
+//
+// This layer makes system calls, so it lives outside the allocator proper
+// (cpen212alloc.c may not call into the OS).
+
+typedef struct mmapArena mmapArena;
+
+// description:
+// - reserve an address range and start a heap in it
+// arguments:
+// - reserve: bytes of address space to reserve; the heap can never grow past this
+// - initial: bytes to commit for the heap to start with (rounded up to whole pages)
+// - policy: placement policy, as for cpen212_init_policy
+// returns:
+// - the arena, or NULL if the reservation or the first commit failed
+mmapArena *cpen212_arena_create(size_t reserve, size_t initial, placementPolicy policy);
+
+// description:
+// - unmap the whole arena; every pointer into it becomes invalid
+void cpen212_arena_destroy(mmapArena *arena);
+
+// description:
+// - the heap handle to pass to the cpen212_* functions (e.g., cpen212_free)
+void *cpen212_arena_heap(mmapArena *arena);
+
+// description:
+// - commit at least nbytes more and append them to the heap
+// returns:
+// - true on success, false if the reservation is used up or the commit failed
+bool cpen212_arena_grow(mmapArena *arena, size_t nbytes);
+
+// description:
+// - cpen212_alloc on the arena's heap, growing the heap and retrying once if it is full
+void *cpen212_arena_alloc(mmapArena *arena, size_t nbytes);
+
+// description:
+// - cpen212_realloc on the arena's heap, growing the heap and retrying once if it is full
+void *cpen212_arena_realloc(mmapArena *arena, void *prev, size_t nbytes);
+
+// description:
+// - cpen212_free on the arena's heap, purging once enough has been freed since the last purge
+void cpen212_arena_free(mmapArena *arena, void *p);
+
+// description:
+// - give the pages inside large free blocks back to the OS now (madvise)
+// returns:
+// - the number of bytes newly given back
+size_t cpen212_arena_purge(mmapArena *arena);
+
+#endif // __CPEN212ARENA_H__
@@ -6,6 +6,8 @@
 // This file is included in cpen212alloc.c and cpen212debug.c,
 // so it would be the right place to define data types they both share.
 
+#include <stdint.h>
+
 /*
 The blockHeader struct represents the metadata for each memory block.
 It is placed immediately before the user-usable space of each block.
@@ -14,8 +16,11 @@ typedef struct blockHeader {
     size_t size; 
 } __attribute__((aligned(8)))blockHeader;
 
-#define BLOCK_ALLOCATED  ((size_t)1) // Use least significant bit
-#define BLOCK_SIZE_MASK  (~BLOCK_ALLOCATED) // Mask to extract actual size
+#define BLOCK_ALLOCATED       ((size_t)1) // Use least significant bit
+#define BLOCK_PREV_ALLOCATED  ((size_t)2) // Set when the block right before this one is allocated
+#define BLOCK_KNOWN_ZERO      ((size_t)4) // Set on free blocks whose payload is zero apart from the links and footer
+#define BLOCK_FLAGS_MASK      ((size_t)7) // Sizes are multiples of 8, so the low 3 bits are flags
+#define BLOCK_SIZE_MASK       (~BLOCK_FLAGS_MASK) // Mask to extract actual size
 
 static inline size_t getBlockSize(blockHeader *block) {
     return block->size & BLOCK_SIZE_MASK;
@@ -30,27 +35,664 @@ static inline void setBlockAllocated(blockHeader *block, bool allocated) {
         block->size |= BLOCK_ALLOCATED;
     }
     else {
-        block->size &= BLOCK_SIZE_MASK;
+        block->size &= ~BLOCK_ALLOCATED;
+    }
+}
+
+static inline bool isPrevBlockAllocated(blockHeader *block) {
+    return (block->size & BLOCK_PREV_ALLOCATED) != 0;
+}
+
+static inline void setPrevBlockAllocated(blockHeader *block, bool allocated) {
+    if(allocated) {
+        block->size |= BLOCK_PREV_ALLOCATED;
+    }
+    else {
+        block->size &= ~BLOCK_PREV_ALLOCATED;
+    }
+}
+
+static inline bool isBlockKnownZero(blockHeader *block) {
+    return (block->size & BLOCK_KNOWN_ZERO) != 0;
+}
+
+static inline void setBlockKnownZero(blockHeader *block, bool knownZero) {
+    if(knownZero) {
+        block->size |= BLOCK_KNOWN_ZERO;
+    }
+    else {
+        block->size &= ~BLOCK_KNOWN_ZERO;
+    }
+}
+
+//change the size of a block, keeping its flags
+static inline void setBlockSize(blockHeader *block, size_t size) {
+    block->size = size | (block->size & BLOCK_FLAGS_MASK);
+}
+
+/*
+The freeBlock struct overlays a block while it is free.
+The explicit free list links are threaded through the payload,
+so a free block must be at least MIN_BLOCK_SIZE bytes to hold them and the footer.
+Each list is circular, so the head's prev is the last block on the list.
+*/
+typedef struct freeBlock {
+    blockHeader header;
+    struct freeBlock *next;
+    struct freeBlock *prev;
+} freeBlock;
+
+#define MIN_BLOCK_SIZE   (sizeof(freeBlock) + sizeof(size_t)) // header + links + footer
+
+//next block on a circular free list, or NULL once the walk is back at the head
+static inline freeBlock *getNextFreeBlock(freeBlock *head, freeBlock *node) {
+    return node->next == head ? NULL : node->next;
+}
+
+/*
+Placement policy, chosen per heap with cpen212_init_policy and kept in the low bits
+of the stored heap size (the heap size is always a multiple of 8):
+- POLICY_FIRST_FIT: lists are LIFO, take the first block that fits
+- POLICY_NEXT_FIT: each list head is a rover, searches resume after the last block handed out
+  and freed blocks join the list right behind the rover
+- POLICY_BEST_FIT: take the smallest block that fits (stopping early on an exact fit)
+- POLICY_ADDRESS_ORDERED: lists are kept sorted by address, take the first block that fits
+All policies search the smallest size class that could fit first; any block in a larger
+class fits. Blocks of LARGE_BLOCK_SIZE and up always use best fit from the size tree.
+CPEN212_TLSF builds always use the TLSF good fit and ignore the policy.
+*/
+typedef enum placementPolicy {
+    POLICY_FIRST_FIT = 0,
+    POLICY_NEXT_FIT = 1,
+    POLICY_BEST_FIT = 2,
+    POLICY_ADDRESS_ORDERED = 3,
+} placementPolicy;
+
+#define HEAP_POLICY_MASK    ((size_t)3)
+#define HEAP_LAST_ALLOCATED ((size_t)4) // Set when the last block is allocated (or there is none), like BLOCK_PREV_ALLOCATED for the heap end
+#define HEAP_FLAGS_MASK     ((size_t)7) // low bits of heapState.size that are not part of the size
+
+#define NUM_FREE_BUCKETS 64 // free extent histogram: bucket i counts free blocks of [2^i, 2^(i+1)) bytes
+
+#ifdef CPEN212_STATS
+/*
+Counters kept in the heap state when building with -DCPEN212_STATS
+(they do not fit in the 64-byte per-heap budget, so they are off by default).
+They are updated as blocks change, so reading them never walks the heap.
+*/
+typedef struct heapStats {
+    size_t searches;        // free list searches made by the placement policy
+    size_t blocksScanned;   // free blocks examined across all searches
+    size_t longestScan;     // most free blocks examined by a single search
+    size_t failedSearches;  // searches that found no block big enough
+    size_t blocks;          // blocks in the heap, allocated or free
+    size_t freeBlocks;      // blocks on the free lists (or in the large block tree)
+    size_t freeBytes;       // total size of those blocks, headers included
+    size_t splits;          // blocks split in two
+    size_t coalesces;       // pairs of neighbouring blocks merged into one
+    size_t reallocsInPlace; // reallocs that kept the data where it was
+    size_t reallocsSlid;    // reallocs that grew into the block before and slid the data down
+    size_t reallocsMoved;   // reallocs that copied the data to a new block
+    size_t freeBuckets[NUM_FREE_BUCKETS]; // free blocks by size, as in heapReport.freeBuckets
+} heapStats;
+#endif
+
+/*
+Hot-path latency profile, kept when building with -DCPEN212_PROFILE.
+The allocator reads the CPU cycle counter around each call and each phase of it and adds
+the difference to a histogram, and records how many free blocks each search examined.
+The histograms live in a heapProfile the debug layer allocates and hangs off the heap state
+(DEBUG_OP_PROFILE_START), since the allocator itself may not allocate memory; until then, and
+in other builds, nothing is timed. Histograms are log-linear: values below 2^PROFILE_SUB_BITS
+are exact, larger ones land in one of 2^PROFILE_SUB_BITS buckets per power of two.
+*/
+typedef enum profilePhase {
+    PHASE_ALLOC,        // whole cpen212_alloc call
+    PHASE_FREE,         // whole cpen212_free call
+    PHASE_REALLOC,      // whole cpen212_realloc call
+    PHASE_SEARCH,       // free list / tree search for a block that fits
+    PHASE_SPLIT,        // splitting the unused tail off an allocated block
+    PHASE_COALESCE,     // freeing a block: merging it with free neighbours and indexing it
+    PHASE_COPY,         // moving data for a realloc
+    NUM_PROFILE_PHASES,
+} profilePhase;
+
+#ifdef CPEN212_PROFILE
+#define PROFILE_SUB_BITS 4
+#define PROFILE_BUCKETS  ((64 - PROFILE_SUB_BITS + 1) << PROFILE_SUB_BITS)
+
+typedef struct profileHistogram {
+    uint64_t counts[PROFILE_BUCKETS];
+    uint64_t total, sum, max;
+} profileHistogram;
+
+typedef struct heapProfile {
+    profileHistogram cycles[NUM_PROFILE_PHASES]; // cycle counter ticks per call or phase
+    profileHistogram blocksVisited;              // free blocks examined per search
+} heapProfile;
+
+static inline size_t getProfileBucket(uint64_t value) {
+    if (value < (1u << PROFILE_SUB_BITS)) {
+        return (size_t)value;
     }
+    unsigned shift = (unsigned)(63 - __builtin_clzll(value)) - PROFILE_SUB_BITS;
+    return ((size_t)(shift + 1) << PROFILE_SUB_BITS) + (size_t)((value >> shift) & ((1u << PROFILE_SUB_BITS) - 1));
+}
+
+static inline void addProfileSample(profileHistogram *histogram, uint64_t value) {
+    histogram->counts[getProfileBucket(value)]++;
+    histogram->total++;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+//the CPU's cycle counter (the virtual counter on ARMv8, whose rate is in cntfrq_el0);
+//reading it is a single instruction, not a system call
+static inline uint64_t readCycleCounter(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(ticks) : : "memory");
+    return ticks;
+#else
+#error "CPEN212_PROFILE needs a cycle counter for this architecture"
+#endif
+}
+#endif
+
+#ifdef CPEN212_SAMPLE
+/*
+Allocation sampling hook, built in with -DCPEN212_SAMPLE. The debug layer's heap profiler
+(DEBUG_OP_SAMPLE_START) hangs a heapSampler off the heap state; the allocator counts each
+request's bytes down from bytesUntilSample and calls onAlloc for the request that takes it
+to zero or below, so on average one allocation per sampling interval is seen. The profiler
+bumps filter[getSampleFilterSlot(p)] for each block it is tracking, so a free only calls
+onFree when the block might be one of them. Everything else happens in the debug layer.
+*/
+#define SAMPLE_FILTER_BITS 12
+
+typedef struct heapSampler heapSampler;
+
+//called with a sampled allocation of nbytes at p, or with a block that may have been sampled being freed
+typedef void (*sampleCallback)(heapSampler *sampler, void *p, size_t nbytes);
+
+struct heapSampler {
+    int64_t bytesUntilSample;   // the allocation that takes this to 0 or below is sampled
+    sampleCallback onAlloc;
+    sampleCallback onFree;      // nbytes is 0
+    uint32_t filter[1 << SAMPLE_FILTER_BITS]; // sampled blocks still allocated, per slot
+};
+
+static inline size_t getSampleFilterSlot(void *p) {
+    return (size_t)(((uintptr_t)p >> 3) * 0x9e3779b97f4a7c15ull >> (64 - SAMPLE_FILTER_BITS));
 }
+#endif
+
+//cpen212_debug op codes (op = 0 is the heap consistency check)
+#define DEBUG_OP_PLACEMENT_STATS 1 // print the placement policy and search counters to stdout
+#define DEBUG_OP_HEAP_STATS      2 // print the heapReport to stdout, or fill one with cpen212_debug_query
+#define DEBUG_OP_PROFILE_START   3 // start (or restart from zero) the latency profile
+#define DEBUG_OP_PROFILE_REPORT  4 // print latency percentiles per phase, or copy the heapProfile with cpen212_debug_query
+#define DEBUG_OP_PROFILE_STOP    5 // stop profiling and release the profile
+#define DEBUG_OP_CHECK_SLICE     6 // check the next slice of the heap with cpen212_debug_query (a heapCheckCursor)
+#define DEBUG_OP_SAMPLE_START    7 // start the sampling heap profiler (cpen212_debug_query takes a size_t sampling interval)
+#define DEBUG_OP_SAMPLE_DUMP     8 // write the heap profile in pprof's legacy text format to stdout (or a FILE * with cpen212_debug_query)
+#define DEBUG_OP_SAMPLE_STOP     9 // stop the heap profiler and release its tables
+#define DEBUG_OP_FRAGMAP_DUMP   10 // write the block layout to stdout, or to an int file descriptor with cpen212_debug_query
+
+/*
+Cursor for checking a heap a slice at a time, so the check can run every so many
+operations on a live heap. Zero it, set sliceBytes, and pass it to
+cpen212_debug_query(heap, DEBUG_OP_CHECK_SLICE, &cursor) as often as wanted; each call
+checks the blocks in the next sliceBytes of the heap, wrapping around at the end.
+A slice covers what op 0 checks block by block, but not the free index as a whole.
+If the block at the cursor changed since the last call, it may no longer start a block,
+so the pass starts over. A problem found after resuming could also come from such a
+change, so it is only reported once the next pass finds it at the same place.
+*/
+typedef struct heapCheckCursor {
+    size_t sliceBytes;  // set by the caller: heap bytes to check per call (0: to the end of the heap)
+    size_t offset;      // next block to check, from the heap handle (0: start a new pass)
+    size_t header;      // the header word of that block when the cursor stopped there
+    size_t suspect;     // offset of a problem waiting to be confirmed (0 if none)
+    size_t passes;      // passes finished
+    size_t restarts;    // passes started over because the heap changed under the cursor
+} heapCheckCursor;
+
+/*
+Snapshot of a heap's usage, filled in by cpen212_debug_query(heap, DEBUG_OP_HEAP_STATS, &report).
+Slab pages count as allocated blocks, whether or not their slots are in use.
+*/
+typedef struct heapReport {
+    size_t allocatedBytes;      // bytes in allocated blocks, headers included
+    size_t freeBytes;           // bytes in free blocks, headers and footers included
+    size_t allocatedBlocks;
+    size_t freeBlocks;
+    size_t largestFreeBlock;    // size of the largest free block (0 if none)
+    double fragmentation;       // external fragmentation: 1 - largestFreeBlock / freeBytes (0 if nothing is free)
+    size_t splits;              // cumulative counts, as in heapStats
+    size_t coalesces;
+    size_t reallocsInPlace;
+    size_t reallocsSlid;
+    size_t reallocsMoved;
+    size_t freeBuckets[NUM_FREE_BUCKETS]; // free blocks of [2^i, 2^(i+1)) bytes
+} heapReport;
+
+/*
+Fragmentation map written by DEBUG_OP_FRAGMAP_DUMP and read by tools/cpen212fragmap.
+The map is FRAGMAP_MAGIC followed by unsigned LEB128 varints:
+
+    version heapSize firstBlock     firstBlock: offset of the first block from the heap handle
+    word count                      one per run of count consecutive blocks with the same word
+    ...
+    0 reached                       reached: offset the walk got to (heapSize unless it
+                                    found a block that runs past the heap end)
+
+A run's word is the block size (a multiple of 8) with FRAGMAP_ALLOCATED and FRAGMAP_SLAB
+in the low bits, so a block's offset is firstBlock plus the sizes of the blocks before it.
+*/
+#define FRAGMAP_MAGIC      "C212MAP\001"
+#define FRAGMAP_MAGIC_SIZE 8
+#define FRAGMAP_VERSION    1
+#define FRAGMAP_ALLOCATED  ((uint64_t)1) // the blocks are allocated
+#define FRAGMAP_SLAB       ((uint64_t)2) // the blocks are slab pages (always allocated)
+#define FRAGMAP_FLAGS_MASK ((uint64_t)7)
+
+/*
+Slab front-end for small requests (up to SLAB_MAX_SIZE bytes).
+A slab page is an ordinary allocated block whose payload starts on a SLAB_PAGE_SIZE
+boundary; the payload begins with a slabPage header followed by fixed-size slots
+that carry no per-object metadata. freeMap has bit i set while slot i is free.
+A pointer into a page finds its header by rounding down to SLAB_PAGE_SIZE, and the
+magic field (SLAB_MAGIC xor the page address) tells a real page from user data.
+Pages with free slots are kept on a per-class list in the slabDirectory, which is
+itself allocated from the heap the first time a slab is needed.
+Heaps smaller than SLAB_MIN_HEAP_SIZE never use slabs, since a single page
+would take up a noticeable share of them.
+*/
+#define SLAB_PAGE_SIZE     ((size_t)1024)
+#define SLAB_MAX_SIZE      ((size_t)64)
+#define SLAB_MIN_HEAP_SIZE (64 * SLAB_PAGE_SIZE)
+#define SLAB_MAGIC         ((uintptr_t)0x5a1b5a1b5a1b5a1bULL)
+#define NUM_SLAB_CLASSES   6 // 8, 16, 24, 32, 48, 64 bytes
+#define SLAB_MAP_WORDS     2
+
+typedef struct slabPage {
+    uintptr_t magic;
+    struct slabPage *next;
+    struct slabPage *prev;
+    uint32_t slotSize;
+    uint32_t freeSlots;
+    uint64_t freeMap[SLAB_MAP_WORDS];
+} slabPage;
+
+typedef struct slabDirectory {
+    slabPage *partial[NUM_SLAB_CLASSES]; // pages with at least one free slot
+} slabDirectory;
+
+static inline size_t getSlabSlotCount(size_t slotSize) {
+    return (SLAB_PAGE_SIZE - sizeof(slabPage)) / slotSize;
+}
+
+static inline char *getSlabSlots(slabPage *page) {
+    return (char *)page + sizeof(slabPage);
+}
+
+#ifdef CPEN212_TLSF
+/*
+Two-level segregated fit (TLSF) index, enabled by building with -DCPEN212_TLSF.
+The first level splits sizes by power of two and the second level splits each
+power of two into TLSF_SL_COUNT linear ranges; blocks under TLSF_SMALL_SIZE all
+share first level 0 and are split by 8-byte steps. flBitmap has bit fl set when any
+list in first level fl is non-empty, slBitmap[fl] has bit sl set when list [fl][sl]
+is non-empty, so a suitable list is found with two count-trailing-zeros.
+The index covers blocks up to 2^TLSF_FL_MAX_LOG2 bytes (the ARMv8 virtual address
+space). It is far larger than 64 bytes, so this mode trades the per-heap budget
+for a constant-time bound on alloc and free.
+*/
+#define TLSF_SL_LOG2      3
+#define TLSF_SL_COUNT     (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT     (TLSF_SL_LOG2 + 3) // 3 = log2 of the 8-byte granularity
+#define TLSF_SMALL_SIZE   ((size_t)1 << TLSF_FL_SHIFT)
+#define TLSF_FL_MAX_LOG2  48
+#define TLSF_FL_COUNT     (TLSF_FL_MAX_LOG2 - TLSF_FL_SHIFT + 1)
+#define NUM_SIZE_CLASSES  (TLSF_FL_COUNT * TLSF_SL_COUNT)
+
+typedef struct heapState {
+    size_t size;
+    uint64_t flBitmap;
+    uint8_t slBitmap[TLSF_FL_COUNT];
+    freeBlock *freeLists[NUM_SIZE_CLASSES]; // list [fl][sl] is freeLists[fl * TLSF_SL_COUNT + sl]
+    slabDirectory *slabs;
+#ifdef CPEN212_STATS
+    heapStats stats;
+#endif
+#ifdef CPEN212_PROFILE
+    heapProfile *profile; // owned by the debug layer, NULL while not profiling
+#endif
+#ifdef CPEN212_SAMPLE
+    heapSampler *sampler; // owned by the debug layer, NULL while not sampling
+#endif
+} heapState;
+#else
+/*
+The treeBlock struct overlays a free block of at least LARGE_BLOCK_SIZE bytes.
+Large free blocks are not on a list but in a splay tree ordered by size and then by
+address, so the best fit among them is found in amortized O(log n).
+*/
+#define LARGE_BLOCK_SIZE ((size_t)1024)
+
+typedef struct treeBlock {
+    blockHeader header;
+    struct treeBlock *left;
+    struct treeBlock *right;
+} treeBlock;
+
+/*
+The heapState struct lives at the start of the heap (the heap handle points to it).
+It holds the heap size (and placement policy), the heads of the segregated free lists,
+the root of the large block tree and the slab directory;
+size class i holds free blocks of [2^(i+5), 2^(i+6)) bytes up to LARGE_BLOCK_SIZE,
+so the whole prologue fits in the 64-byte per-heap budget.
+*/
+#define NUM_SIZE_CLASSES 5
+
+typedef struct heapState {
+    size_t size;
+    freeBlock *freeLists[NUM_SIZE_CLASSES];
+    treeBlock *largeBlocks;
+    slabDirectory *slabs;
+#ifdef CPEN212_STATS
+    heapStats stats;
+#endif
+#ifdef CPEN212_PROFILE
+    heapProfile *profile; // owned by the debug layer, NULL while not profiling
+#endif
+#ifdef CPEN212_SAMPLE
+    heapSampler *sampler; // owned by the debug layer, NULL while not sampling
+#endif
+} heapState;
+
+#if !defined(CPEN212_STATS) && !defined(CPEN212_PROFILE) && !defined(CPEN212_SAMPLE)
+_Static_assert(sizeof(heapState) <= 64, "per-heap overhead must not exceed 64 bytes");
+#endif
+#endif
 
 static inline size_t getHeapSize(void *heap_handle) {
-    return *((size_t *)heap_handle);
+    return ((heapState *)heap_handle)->size & ~HEAP_FLAGS_MASK;
+}
+
+static inline placementPolicy getHeapPolicy(void *heap_handle) {
+    return (placementPolicy)(((heapState *)heap_handle)->size & HEAP_POLICY_MASK);
+}
+
+static inline bool isLastBlockAllocated(void *heap_handle) {
+    return (((heapState *)heap_handle)->size & HEAP_LAST_ALLOCATED) != 0;
+}
+
+static inline void setLastBlockAllocated(void *heap_handle, bool allocated) {
+    if(allocated) {
+        ((heapState *)heap_handle)->size |= HEAP_LAST_ALLOCATED;
+    }
+    else {
+        ((heapState *)heap_handle)->size &= ~HEAP_LAST_ALLOCATED;
+    }
+}
+
+static inline blockHeader *getFirstBlock(void *heap_handle) {
+    return (blockHeader *)((char *)heap_handle + sizeof(heapState));
+}
+
+static inline char *getHeapEnd(void *heap_handle) {
+    return (char *)heap_handle + getHeapSize(heap_handle);
+}
+
+//slab page holding p, or NULL if p came from a regular block
+static inline slabPage *getSlabPage(void *heap_handle, void *p) {
+    if (!((heapState *)heap_handle)->slabs) {
+        return NULL; //no slab page was ever made on this heap
+    }
+
+    slabPage *page = (slabPage *)((uintptr_t)p & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+    if ((char *)page < (char *)getFirstBlock(heap_handle) + sizeof(blockHeader)
+        || (char *)p < getSlabSlots(page)) {
+        return NULL; //slots never start before the page header ends
+    }
+    if (page->magic != (SLAB_MAGIC ^ (uintptr_t)page)) {
+        return NULL;
+    }
+    return page;
+}
+
+//bytes the caller may use at p, a live pointer returned by cpen212_alloc on this heap
+static inline size_t getUsableSize(void *heap_handle, void *p) {
+    slabPage *page = getSlabPage(heap_handle, p);
+    if (page) {
+        return page->slotSize;
+    }
+    blockHeader *block = (blockHeader *)((char *)p - sizeof(blockHeader));
+    return getBlockSize(block) - sizeof(blockHeader);
+}
+
+static inline blockHeader *getNextBlock(blockHeader *block) {
+    return (blockHeader *)((char *)block + getBlockSize(block));
 }
 
 static inline size_t *getBlockFooter(blockHeader *block) {
     return (size_t *)((char *)block + getBlockSize(block) - sizeof(size_t));
 }
 
+#define FOOTER_PURGED ((size_t)1) // Set by cpen212_purge once the block's interior pages were handed back
+
+//the footer only holds the size, since the flags in the header change while the block is free;
+//rewriting it also clears FOOTER_PURGED, so a block that changed is purged again next time
 static inline void setBlockFooter(blockHeader *block) {
     size_t *footer = getBlockFooter(block);
-    *footer = block->size;
+    *footer = getBlockSize(block);
 }
 
+//only free blocks have footers, so this is only valid when !isPrevBlockAllocated(block)
 static inline blockHeader *getPrevBlock(blockHeader *block) {
     size_t *prevFooter = (size_t *)((char *)block - sizeof(size_t));
     size_t prevSize = *prevFooter & BLOCK_SIZE_MASK;
     return (blockHeader *)((char *)block - prevSize);
 }
 
+#ifdef CPEN212_TLSF
+static inline size_t getSizeClass(size_t size) {
+    if (size < TLSF_SMALL_SIZE) {
+        return size >> 3; //first level 0, linear 8-byte steps
+    }
+    size_t log2Size = (size_t)(63 - __builtin_clzl(size));
+    size_t fl = log2Size - TLSF_FL_SHIFT + 1;
+    size_t sl = (size >> (log2Size - TLSF_SL_LOG2)) & (TLSF_SL_COUNT - 1);
+    return fl * TLSF_SL_COUNT + sl;
+}
+#else
+//list for a block smaller than LARGE_BLOCK_SIZE (larger blocks go in the tree)
+static inline size_t getSizeClass(size_t size) {
+    //floor(log2(size)) - 5, clamped to the available classes
+    if (size < MIN_BLOCK_SIZE) {
+        return 0;
+    }
+    size_t sizeClass = (size_t)(63 - __builtin_clzl(size)) - 5;
+    return sizeClass < NUM_SIZE_CLASSES ? sizeClass : NUM_SIZE_CLASSES - 1;
+}
+#endif
+
+/*
+Extensions to the cpen212alloc.h interface.
+*/
+
+// description:
+// - initialize an allocator like cpen212_init, choosing its placement policy
+// arguments:
+// - heap_start, heap_end: as for cpen212_init
+// - policy: one of the placementPolicy values
+// returns:
+// - an allocator state pointer as for cpen212_init, or NULL if the policy is unknown
+void *cpen212_init_policy(void *heap_start, void *heap_end, placementPolicy policy);
+
+// description:
+// - allocate nbytes from a slab page only
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - nbytes: as for cpen212_alloc
+// returns:
+// - pointer p as for cpen212_alloc, or NULL if nbytes is over SLAB_MAX_SIZE,
+//   the heap is too small for slabs, or no slot is free and no page can be made
+// other:
+// - p may be passed to cpen212_free and cpen212_realloc like any other block
+void *cpen212_alloc_slot(void *heap_handle, size_t nbytes);
+
+// description:
+// - cpen212_alloc, cpen212_realloc and cpen212_free for regular blocks: these never
+//   hand out a slab slot, and never look for a slab page around the block they get
+// arguments:
+// - as for cpen212_alloc, cpen212_realloc and cpen212_free; prev and p must not be
+//   slab slots (i.e., they came from cpen212_alloc_block or cpen212_realloc_block)
+// returns:
+// - as for cpen212_alloc and cpen212_realloc
+// other:
+// - the slab probe in cpen212_free and cpen212_realloc reads the first word of the
+//   1 KB page around the block, which for a regular block is usually part of some
+//   other block; callers that let other threads write their blocks without holding
+//   the heap lock (see cpen212mt.h) must not make that read
+void *cpen212_alloc_block(void *heap_handle, size_t nbytes);
+void *cpen212_realloc_block(void *heap_handle, void *prev, size_t nbytes);
+void cpen212_free_block(void *heap_handle, void *p);
+
+// description:
+// - allocate up to n blocks of nbytes each, carving several from one free extent at a time
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - nbytes: bytes in each block, as for cpen212_alloc
+// - n: number of blocks wanted
+// - out: receives the allocated pointers in out[0..k)
+// returns:
+// - k, the number of blocks allocated (less than n only if the heap ran out)
+size_t cpen212_alloc_batch(void *heap_handle, size_t nbytes, size_t n, void **out);
+
+// description:
+// - free n blocks at once, coalescing runs of adjacent blocks in one step
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - ptrs: pointers as for cpen212_free (NULL entries are skipped);
+//   the array is sorted by address in place
+// - n: number of entries in ptrs
+void cpen212_free_batch(void *heap_handle, void **ptrs, size_t n);
+
+// description:
+// - allocate a block whose address is a multiple of alignment
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - alignment: a power of two
+// - nbytes: as for cpen212_alloc
+// returns:
+// - pointer p as for cpen212_alloc, aligned on an alignment boundary,
+//   or NULL if alignment is not a power of two or no free block can hold an aligned payload
+// other:
+// - p may be passed to cpen212_free and cpen212_realloc; a block moved by
+//   cpen212_realloc is only guaranteed 8-byte alignment
+void *cpen212_memalign(void *heap_handle, size_t alignment, size_t nbytes);
+
+// description:
+// - initialize an allocator like cpen212_init_policy over memory the caller knows is all zero
+//   (e.g., fresh anonymous pages), so cpen212_calloc can skip zeroing blocks that were never used
+// arguments:
+// - heap_start, heap_end, policy: as for cpen212_init_policy; every byte in [heap_start, heap_end) must be 0
+// returns:
+// - an allocator state pointer as for cpen212_init_policy
+void *cpen212_init_zeroed(void *heap_start, void *heap_end, placementPolicy policy);
+
+// description:
+// - allocate a zero-filled array of n elements of size bytes each
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - n, size: element count and element size
+// returns:
+// - pointer p as for cpen212_alloc with [p, p+n*size) set to 0,
+//   or NULL if n*size overflows, is 0, or does not fit
+void *cpen212_calloc(void *heap_handle, size_t n, size_t size);
+
+// description:
+// - report how many bytes the caller may actually use at p
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - p: a pointer returned by an allocation function on this heap and not yet freed
+// returns:
+// - the usable size, which is at least the size requested for p (0 if p is NULL)
+size_t cpen212_usable_size(void *heap_handle, void *p);
+
+// description:
+// - grow the block at p in place into a free successor; never moves the block
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - p: a pointer returned by an allocation function on this heap and not yet freed
+// - min: bytes the caller needs
+// - preferred: bytes the caller would like; as much of this as fits is taken
+// returns:
+// - the new usable size at p (at least min), or 0 if p cannot hold min bytes in place,
+//   in which case the block is unchanged
+size_t cpen212_try_expand(void *heap_handle, void *p, size_t min, size_t preferred);
+
+// description:
+// - grow a heap by appending [current heap end, new_end), which must be memory the caller owns
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - new_end: the new heap end; aligned on an 8-byte boundary and at least MIN_BLOCK_SIZE
+//   bytes past the current end
+// returns:
+// - true if the heap now ends at new_end; the new space is merged into the last block
+//   if that block is free, or becomes a new free block otherwise
+// other:
+// - the new space is not assumed to be zero (see cpen212_init_zeroed)
+bool cpen212_extend(void *heap_handle, void *new_end);
+
+//called by cpen212_purge with a page-aligned range inside a free block whose contents may be discarded
+typedef void (*purgeCallback)(void *ctx, void *start, size_t length);
+
+// description:
+// - hand the whole pages inside large free blocks to a callback (e.g., one that calls madvise),
+//   skipping the pages holding a block's header, free list links and footer
+// arguments:
+// - heap_handle: the pointer returned by cpen212_init()
+// - pageSize: the page size, a power of two
+// - purge: called once per range; the range may afterwards read back as zero or unchanged
+// - ctx: passed through to purge
+// returns:
+// - the number of bytes passed to purge
+// other:
+// - blocks purged before and not changed since are skipped, so calling this often is cheap
+size_t cpen212_purge(void *heap_handle, size_t pageSize, purgeCallback purge, void *ctx);
+
+// description:
+// - report structured statistics about a heap, for the cpen212_debug ops that have them
+// arguments:
+// - alloc_state: the pointer returned by cpen212_init()
+// - op: DEBUG_OP_HEAP_STATS, DEBUG_OP_PROFILE_REPORT, DEBUG_OP_CHECK_SLICE,
+//   DEBUG_OP_SAMPLE_START, DEBUG_OP_SAMPLE_DUMP or DEBUG_OP_FRAGMAP_DUMP
+// - out: the struct the op reports into or works on (a heapReport, a heapProfile,
+//   a heapCheckCursor, a size_t sampling interval in bytes, a FILE * to write to,
+//   or an int file descriptor to write to)
+// returns:
+// - for DEBUG_OP_CHECK_SLICE, 1 if the slice passed and 0 if a problem was found
+//   (it is printed to stderr, and the cursor starts a new pass next time)
+// - for the sampling ops, 1 on success and 0 if sampling is not built in
+//   (it needs -DCPEN212_SAMPLE) or not started, or memory ran out
+// - for DEBUG_OP_FRAGMAP_DUMP, 1 if the whole map was written, 0 if a write failed
+//   or the walk stopped at a broken block (the map still ends where it stopped)
+// - otherwise 1 if *out was filled in, 0 if op has no report or the counters it needs
+//   are not kept (heap counters need -DCPEN212_STATS, and the profile needs
+//   -DCPEN212_PROFILE and DEBUG_OP_PROFILE_START)
+// other:
+// - DEBUG_OP_HEAP_STATS takes constant time apart from finding the largest free block,
+//   which only looks at the top of the free index, never the whole heap
+// - DEBUG_OP_FRAGMAP_DUMP walks the heap once without allocating, writing a few bytes
+//   per run of like blocks, so it can be called when an allocation fails
+int cpen212_debug_query(void *alloc_state, int op, void *out);
+
 #endif // __CPEN212COMMON_H__
@@ -1,10 +1,1078 @@
 #include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "cpen212alloc.h"
 #include "cpen212common.h"
+#ifdef CPEN212_SAMPLE
+#include <execinfo.h>
+#include <math.h>
+#endif
 
 // YOUR CODE HERE
 
-int cpen212_debug(void *alloc_state, int op) {
+#ifndef CPEN212_TLSF
+static const char *getPolicyName(placementPolicy policy) {
+    switch (policy) {
+    case POLICY_FIRST_FIT:
+        return "first-fit";
+    case POLICY_NEXT_FIT:
+        return "next-fit";
+    case POLICY_BEST_FIT:
+        return "best-fit";
+    case POLICY_ADDRESS_ORDERED:
+        return "address-ordered first-fit";
+    }
+    return "unknown";
+}
+#endif
+
+static int printPlacementStats(void *alloc_state) {
+#ifdef CPEN212_TLSF
+    (void)alloc_state;
+    printf("policy: tlsf good-fit\n");
+#else
+    printf("policy: %s\n", getPolicyName(getHeapPolicy(alloc_state)));
+#endif
+#ifdef CPEN212_STATS
+    heapStats *stats = &((heapState *)alloc_state)->stats;
+    double average = stats->searches ? (double)stats->blocksScanned / (double)stats->searches : 0.0;
+    printf("searches: %zu (%zu failed)\n", stats->searches, stats->failedSearches);
+    printf("blocks scanned: %zu total, %.2f per search, %zu longest\n",
+           stats->blocksScanned, average, stats->longestScan);
+#else
+    printf("search counters need a -DCPEN212_STATS build\n");
+#endif
+    return 1;
+}
+
+#ifdef CPEN212_STATS
+//largest block on one circular free list
+static size_t getLargestOnList(freeBlock *head) {
+    size_t largest = 0;
+    for (freeBlock *node = head; node; node = getNextFreeBlock(head, node)) {
+        size_t size = getBlockSize(&node->header);
+        largest = size > largest ? size : largest;
+    }
+    return largest;
+}
+
+//size of the largest free block: only the top of the free index can hold it
+static size_t getLargestFreeBlock(heapState *state) {
+#ifdef CPEN212_TLSF
+    if (!state->flBitmap) {
+        return 0;
+    }
+    size_t fl = (size_t)(63 - __builtin_clzl(state->flBitmap));
+    size_t sl = (size_t)(31 - __builtin_clz(state->slBitmap[fl]));
+    return getLargestOnList(state->freeLists[fl * TLSF_SL_COUNT + sl]);
+#else
+    if (state->largeBlocks) {
+        //the tree is ordered by size, so the largest block is at the far right
+        treeBlock *node = state->largeBlocks;
+        while (node->right) {
+            node = node->right;
+        }
+        return getBlockSize(&node->header);
+    }
+    for (size_t sizeClass = NUM_SIZE_CLASSES; sizeClass > 0; sizeClass--) {
+        if (state->freeLists[sizeClass - 1]) {
+            return getLargestOnList(state->freeLists[sizeClass - 1]);
+        }
+    }
     return 0;
+#endif
+}
+
+static void fillHeapReport(heapState *state, heapReport *report) {
+    heapStats *stats = &state->stats;
+    size_t blockBytes = getHeapSize(state) - sizeof(heapState);
+
+    report->freeBytes = stats->freeBytes;
+    report->allocatedBytes = blockBytes - stats->freeBytes;
+    report->freeBlocks = stats->freeBlocks;
+    report->allocatedBlocks = stats->blocks - stats->freeBlocks;
+    report->largestFreeBlock = getLargestFreeBlock(state);
+    report->fragmentation = stats->freeBytes
+                            ? 1.0 - (double)report->largestFreeBlock / (double)stats->freeBytes : 0.0;
+    report->splits = stats->splits;
+    report->coalesces = stats->coalesces;
+    report->reallocsInPlace = stats->reallocsInPlace;
+    report->reallocsSlid = stats->reallocsSlid;
+    report->reallocsMoved = stats->reallocsMoved;
+    memcpy(report->freeBuckets, stats->freeBuckets, sizeof(report->freeBuckets));
+}
+#endif
+
+static int printHeapStats(void *alloc_state) {
+    heapReport report;
+    if (!cpen212_debug_query(alloc_state, DEBUG_OP_HEAP_STATS, &report)) {
+        printf("heap counters need a -DCPEN212_STATS build\n");
+        return 1;
+    }
+
+    printf("allocated: %zu bytes in %zu blocks\n", report.allocatedBytes, report.allocatedBlocks);
+    printf("free: %zu bytes in %zu blocks, largest %zu\n",
+           report.freeBytes, report.freeBlocks, report.largestFreeBlock);
+    printf("external fragmentation: %.4f\n", report.fragmentation);
+    printf("splits: %zu, coalesces: %zu\n", report.splits, report.coalesces);
+    printf("reallocs: %zu in place, %zu slid, %zu moved\n",
+           report.reallocsInPlace, report.reallocsSlid, report.reallocsMoved);
+    for (size_t i = 0; i < NUM_FREE_BUCKETS; i++) {
+        if (report.freeBuckets[i]) {
+            printf("free [%zu, %zu): %zu\n", (size_t)1 << i, (size_t)2 << i, report.freeBuckets[i]);
+        }
+    }
+    return 1;
+}
+
+#ifdef CPEN212_PROFILE
+static const char *phaseNames[NUM_PROFILE_PHASES] = {
+    "alloc", "free", "realloc", "search", "split", "coalesce", "copy",
+};
+
+//smallest value that lands in bucket
+static uint64_t getProfileBucketStart(size_t bucket) {
+    if (bucket < (1u << PROFILE_SUB_BITS)) {
+        return bucket;
+    }
+    unsigned shift = (unsigned)(bucket >> PROFILE_SUB_BITS) - 1;
+    return (uint64_t)((1u << PROFILE_SUB_BITS) + (bucket & ((1u << PROFILE_SUB_BITS) - 1))) << shift;
+}
+
+static uint64_t getProfilePercentile(const profileHistogram *histogram, double percentile) {
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->total + 0.5);
+    rank = rank ? rank : 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < PROFILE_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            uint64_t start = getProfileBucketStart(i);
+            return start < histogram->max ? start : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static void printProfileRow(const char *name, const profileHistogram *histogram) {
+    printf("%-10s %10llu %10.1f %8llu %8llu %8llu %8llu %10llu\n", name, (unsigned long long)histogram->total,
+           (double)histogram->sum / (double)histogram->total,
+           (unsigned long long)getProfilePercentile(histogram, 50),
+           (unsigned long long)getProfilePercentile(histogram, 90),
+           (unsigned long long)getProfilePercentile(histogram, 99),
+           (unsigned long long)getProfilePercentile(histogram, 99.9), (unsigned long long)histogram->max);
+}
+#endif
+
+//attach a zeroed profile to the heap, reusing the one already there
+static int startProfile(void *alloc_state) {
+#ifdef CPEN212_PROFILE
+    heapState *state = (heapState *)alloc_state;
+    if (!state->profile) {
+        state->profile = malloc(sizeof(heapProfile));
+        if (!state->profile) {
+            return 0;
+        }
+    }
+    memset(state->profile, 0, sizeof(heapProfile));
+    return 1;
+#else
+    (void)alloc_state;
+    printf("latency profiling needs a -DCPEN212_PROFILE build\n");
+    return 0;
+#endif
+}
+
+static int printProfile(void *alloc_state) {
+#ifdef CPEN212_PROFILE
+    heapProfile *profile = ((heapState *)alloc_state)->profile;
+    if (!profile) {
+        printf("not profiling (start with op %d)\n", DEBUG_OP_PROFILE_START);
+        return 0;
+    }
+    printf("%-10s %10s %10s %8s %8s %8s %8s %10s\n", "cycles", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int phase = 0; phase < NUM_PROFILE_PHASES; phase++) {
+        if (profile->cycles[phase].total) {
+            printProfileRow(phaseNames[phase], &profile->cycles[phase]);
+        }
+    }
+    if (profile->blocksVisited.total) {
+        printf("free blocks examined per search:\n");
+        printProfileRow("visited", &profile->blocksVisited);
+    }
+    return 1;
+#else
+    (void)alloc_state;
+    printf("latency profiling needs a -DCPEN212_PROFILE build\n");
+    return 0;
+#endif
+}
+
+static int stopProfile(void *alloc_state) {
+#ifdef CPEN212_PROFILE
+    heapState *state = (heapState *)alloc_state;
+    free(state->profile);
+    state->profile = NULL;
+    return 1;
+#else
+    (void)alloc_state;
+    return 0;
+#endif
+}
+
+/*
+Heap consistency check (op 0, and DEBUG_OP_CHECK_SLICE a slice at a time).
+Walking the blocks is a chain of dependent loads, since each header gives the next
+one's address, so it cannot be vectorised. Blocks are laid out in address order, though,
+so the walk prefetches CHECK_PREFETCH_DISTANCE bytes ahead, and it puts off checking each
+free block's footer (which may be megabytes past its header) until CHECK_BATCH free blocks
+later, after a prefetch has had time to bring it in. The free index is checked against
+the walk by block count and bytes in one pass over the lists and tree, rather than by
+looking up every free block.
+*/
+#define CHECK_PREFETCH_DISTANCE 512
+#define CHECK_BATCH             16
+
+typedef struct heapCheck {
+    char *heap;             // the heap handle
+    char *end;              // the heap end
+    const char *problem;    // first problem found, NULL if none
+    size_t problemOffset;   // where it was found, from the heap handle
+    size_t blocks, freeBlocks, freeBytes;
+    size_t freeBuckets[NUM_FREE_BUCKETS];
+    blockHeader *pending[CHECK_BATCH]; // free blocks whose footers are still to be checked (a ring)
+    size_t numDeferred;     // footer checks put off so far
+} heapCheck;
+
+static void initCheck(heapCheck *check, void *alloc_state) {
+    memset(check, 0, sizeof(*check));
+    check->heap = (char *)alloc_state;
+    check->end = getHeapEnd(alloc_state);
+}
+
+//record the first problem; always returns false so callers can return it
+static bool reportProblem(heapCheck *check, const void *where, const char *problem) {
+    if (!check->problem) {
+        check->problem = problem;
+        check->problemOffset = (size_t)((const char *)where - check->heap);
+    }
+    return false;
+}
+
+static void printProblem(const heapCheck *check) {
+    fprintf(stderr, "heap check failed at offset %zu: %s\n", check->problemOffset, check->problem);
+}
+
+//could p be a block in this heap?
+static bool isInHeap(const heapCheck *check, const void *p) {
+    const char *c = (const char *)p;
+    return c >= (char *)getFirstBlock(check->heap) && c < check->end && ((uintptr_t)c & 7) == 0;
+}
+
+static bool checkFooter(heapCheck *check, blockHeader *block) {
+    if ((*getBlockFooter(block) & ~FOOTER_PURGED) != getBlockSize(block)) {
+        return reportProblem(check, block, "footer does not match the header");
+    }
+    return true;
+}
+
+//put off the footer check of a free block, doing the oldest one put off if the ring is full
+static bool deferFooterCheck(heapCheck *check, blockHeader *block) {
+    __builtin_prefetch(getBlockFooter(block));
+    blockHeader **slot = &check->pending[check->numDeferred++ % CHECK_BATCH];
+    bool ok = check->numDeferred <= CHECK_BATCH || checkFooter(check, *slot);
+    *slot = block;
+    return ok;
+}
+
+static bool flushFooterChecks(heapCheck *check) {
+    size_t pending = check->numDeferred < CHECK_BATCH ? check->numDeferred : CHECK_BATCH;
+    for (size_t i = 0; i < pending; i++) {
+        if (!checkFooter(check, check->pending[i])) {
+            return false;
+        }
+    }
+    check->numDeferred = 0;
+    return true;
+}
+
+static bool checkHeapState(heapCheck *check) {
+    heapState *state = (heapState *)check->heap;
+    if (getHeapSize(state) < sizeof(heapState)) {
+        return reportProblem(check, state, "heap size is smaller than the heap state");
+    }
+    if (state->slabs && !isInHeap(check, state->slabs)) {
+        return reportProblem(check, state, "slab directory is outside the heap");
+    }
+    return true;
+}
+
+//the slot bookkeeping of a slab page, if block holds one
+static bool checkSlabPage(heapCheck *check, blockHeader *block) {
+    slabPage *page = (slabPage *)((char *)block + sizeof(blockHeader));
+    if (!((heapState *)check->heap)->slabs || ((uintptr_t)page & (SLAB_PAGE_SIZE - 1))
+        || page->magic != (SLAB_MAGIC ^ (uintptr_t)page)) {
+        return true; //an ordinary block
+    }
+    if (getBlockSize(block) < sizeof(blockHeader) + SLAB_PAGE_SIZE) {
+        return reportProblem(check, block, "slab page is bigger than its block");
+    }
+
+    size_t slotSize = page->slotSize;
+    if (slotSize == 0 || slotSize > SLAB_MAX_SIZE || slotSize % 8 || (slotSize > 32 && slotSize % 16)) {
+        return reportProblem(check, block, "slab page has an unknown slot size");
+    }
+    size_t slotCount = getSlabSlotCount(slotSize);
+    size_t freeSlots = 0;
+    for (size_t i = 0; i < SLAB_MAP_WORDS; i++) {
+        size_t bits = slotCount > i * 64 ? slotCount - i * 64 : 0;
+        uint64_t valid = bits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+        if (page->freeMap[i] & ~valid) {
+            return reportProblem(check, block, "slab free map marks slots past the end of the page");
+        }
+        freeSlots += (size_t)__builtin_popcountll(page->freeMap[i]);
+    }
+    if (freeSlots != page->freeSlots) {
+        return reportProblem(check, block, "slab page free count does not match its free map");
+    }
+    return true;
+}
+
+//free list or tree links of a free block (tree children may be NULL)
+static bool checkFreeLinks(heapCheck *check, blockHeader *block) {
+    freeBlock *node = (freeBlock *)block;
+    bool mayBeNull = false;
+#ifndef CPEN212_TLSF
+    mayBeNull = getBlockSize(block) >= LARGE_BLOCK_SIZE;
+#endif
+    if ((node->next || !mayBeNull) && !isInHeap(check, node->next)) {
+        return reportProblem(check, block, "free block link points outside the heap");
+    }
+    if ((node->prev || !mayBeNull) && !isInHeap(check, node->prev)) {
+        return reportProblem(check, block, "free block link points outside the heap");
+    }
+    return true;
+}
+
+//check the blocks from block to the first block boundary at or past stop; knownPrev says
+//whether prevAllocated holds the state of the block before (false when resuming mid-heap);
+//returns where it stopped, or NULL if it found a problem
+static blockHeader *checkBlocks(heapCheck *check, blockHeader *block, char *stop, bool knownPrev, bool prevAllocated) {
+    blockHeader *first = getFirstBlock(check->heap);
+
+    while ((char *)block < stop) {
+        char *here = (char *)block;
+        __builtin_prefetch(here + CHECK_PREFETCH_DISTANCE);
+        size_t size = getBlockSize(block);
+        bool allocated = isBlockAllocated(block);
+
+        if (size > (size_t)(check->end - here)) {
+            reportProblem(check, block, "block runs past the heap end");
+            return NULL;
+        }
+        //only a heap too small for any real block has a block under MIN_BLOCK_SIZE, and it stays allocated
+        if (size < MIN_BLOCK_SIZE && !(block == first && here + size == check->end && allocated)) {
+            reportProblem(check, block, "block is smaller than MIN_BLOCK_SIZE");
+            return NULL;
+        }
+        if (knownPrev && isPrevBlockAllocated(block) != prevAllocated) {
+            reportProblem(check, block, "BLOCK_PREV_ALLOCATED does not match the block before");
+            return NULL;
+        }
+
+        if (allocated) {
+            if (isBlockKnownZero(block)) {
+                reportProblem(check, block, "allocated block has BLOCK_KNOWN_ZERO set");
+                return NULL;
+            }
+            if (!checkSlabPage(check, block)) {
+                return NULL;
+            }
+        } else {
+            if (!isPrevBlockAllocated(block)) {
+                reportProblem(check, block, "two free blocks in a row");
+                return NULL;
+            }
+            if (!checkFreeLinks(check, block) || !deferFooterCheck(check, block)) {
+                return NULL;
+            }
+            check->freeBlocks++;
+            check->freeBytes += size;
+            check->freeBuckets[63 - __builtin_clzl(size)]++;
+        }
+
+        check->blocks++;
+        knownPrev = true;
+        prevAllocated = allocated;
+        block = (blockHeader *)(here + size);
+    }
+
+    if (!flushFooterChecks(check)) {
+        return NULL;
+    }
+    if ((char *)block == check->end && knownPrev && isLastBlockAllocated(check->heap) != prevAllocated) {
+        reportProblem(check, block, "HEAP_LAST_ALLOCATED does not match the last block");
+        return NULL;
+    }
+    return block;
+}
+
+//check every block on one circular free list, adding them to count and bytes
+static bool checkFreeList(heapCheck *check, freeBlock *head, size_t sizeClass, size_t *count, size_t *bytes) {
+    bool addressOrdered = getHeapPolicy(check->heap) == POLICY_ADDRESS_ORDERED;
+    freeBlock *node = head;
+    do {
+        if (!isInHeap(check, node) || !isInHeap(check, node->next)) {
+            return reportProblem(check, head, "free list link points outside the heap");
+        }
+        size_t size = getBlockSize(&node->header);
+        if (isBlockAllocated(&node->header)) {
+            return reportProblem(check, node, "allocated block on a free list");
+        }
+#ifndef CPEN212_TLSF
+        if (size >= LARGE_BLOCK_SIZE) {
+            return reportProblem(check, node, "large block on a free list instead of in the tree");
+        }
+#endif
+        if (getSizeClass(size) != sizeClass) {
+            return reportProblem(check, node, "free block is on the wrong size class list");
+        }
+        if (node->next->prev != node) {
+            return reportProblem(check, node, "free list links do not agree");
+        }
+        if (addressOrdered && node->next != head && node->next < node) {
+            return reportProblem(check, node, "address-ordered free list is out of order");
+        }
+        if (++*count > check->freeBlocks) {
+            return reportProblem(check, head, "free index holds more blocks than the heap has free");
+        }
+        *bytes += size;
+        node = node->next;
+    } while (node != head);
+    return true;
+}
+
+#ifndef CPEN212_TLSF
+//in-order walk of the large block tree with an explicit stack, since it may be deep
+static bool checkTree(heapCheck *check, treeBlock *root, size_t *count, size_t *bytes) {
+    size_t capacity = 64, depth = 0;
+    treeBlock **stack = malloc(capacity * sizeof(treeBlock *));
+    if (!stack) {
+        fprintf(stderr, "heap check: no memory to walk the large block tree, skipping it\n");
+        return true;
+    }
+
+    bool ok = true;
+    treeBlock *last = NULL;
+    treeBlock *node = root;
+    while (ok && (node || depth)) {
+        if (node) {
+            if (!isInHeap(check, node)) {
+                ok = reportProblem(check, root, "large block tree link points outside the heap");
+            } else if (depth > check->freeBlocks) {
+                ok = reportProblem(check, root, "large block tree has a cycle");
+            } else {
+                if (depth == capacity) {
+                    capacity *= 2;
+                    treeBlock **grown = realloc(stack, capacity * sizeof(treeBlock *));
+                    if (!grown) {
+                        fprintf(stderr, "heap check: no memory to walk the large block tree, skipping it\n");
+                        break;
+                    }
+                    stack = grown;
+                }
+                stack[depth++] = node;
+                node = node->left;
+            }
+            continue;
+        }
+
+        node = stack[--depth];
+        size_t size = getBlockSize(&node->header);
+        if (isBlockAllocated(&node->header)) {
+            ok = reportProblem(check, node, "allocated block in the large block tree");
+        } else if (size < LARGE_BLOCK_SIZE) {
+            ok = reportProblem(check, node, "small block in the large block tree");
+        } else if (last && (size < getBlockSize(&last->header)
+                            || (size == getBlockSize(&last->header) && node <= last))) {
+            ok = reportProblem(check, node, "large block tree is out of order");
+        } else if (++*count > check->freeBlocks) {
+            ok = reportProblem(check, root, "free index holds more blocks than the heap has free");
+        }
+        *bytes += size;
+        last = node;
+        node = node->right;
+    }
+    free(stack);
+    return ok;
+}
+#endif
+
+//the free lists (and tree) must hold exactly the free blocks the walk found
+static bool checkFreeIndex(heapCheck *check) {
+    heapState *state = (heapState *)check->heap;
+    size_t count = 0, bytes = 0;
+
+#ifdef CPEN212_TLSF
+    if (state->flBitmap >> TLSF_FL_COUNT) {
+        return reportProblem(check, state, "TLSF first-level bitmap has bits past the index");
+    }
+    for (size_t fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        if ((bool)((state->flBitmap >> fl) & 1) != (state->slBitmap[fl] != 0)) {
+            return reportProblem(check, state, "TLSF first-level bitmap does not match the second level");
+        }
+        for (size_t sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            freeBlock *head = state->freeLists[fl * TLSF_SL_COUNT + sl];
+            if ((bool)((state->slBitmap[fl] >> sl) & 1) != (head != NULL)) {
+                return reportProblem(check, state, "TLSF second-level bitmap does not match its list");
+            }
+            if (head && !checkFreeList(check, head, fl * TLSF_SL_COUNT + sl, &count, &bytes)) {
+                return false;
+            }
+        }
+    }
+#else
+    for (size_t sizeClass = 0; sizeClass < NUM_SIZE_CLASSES; sizeClass++) {
+        freeBlock *head = state->freeLists[sizeClass];
+        if (head && !checkFreeList(check, head, sizeClass, &count, &bytes)) {
+            return false;
+        }
+    }
+    if (state->largeBlocks && !checkTree(check, state->largeBlocks, &count, &bytes)) {
+        return false;
+    }
+#endif
+
+    if (count != check->freeBlocks || bytes != check->freeBytes) {
+        return reportProblem(check, state, "free index does not hold exactly the free blocks in the heap");
+    }
+    return true;
+}
+
+//the incremental counters must agree with the walk (CPEN212_STATS builds only)
+static bool checkCounters(heapCheck *check) {
+#ifdef CPEN212_STATS
+    heapStats *stats = &((heapState *)check->heap)->stats;
+    if (stats->blocks != check->blocks || stats->freeBlocks != check->freeBlocks
+        || stats->freeBytes != check->freeBytes
+        || memcmp(stats->freeBuckets, check->freeBuckets, sizeof(check->freeBuckets)) != 0) {
+        return reportProblem(check, stats, "heap counters do not match the heap");
+    }
+#else
+    (void)check;
+#endif
+    return true;
+}
+
+static int checkHeap(void *alloc_state) {
+    if (!alloc_state) {
+        return 0;
+    }
+    heapCheck check;
+    initCheck(&check, alloc_state);
+    if (!checkHeapState(&check) || !checkBlocks(&check, getFirstBlock(alloc_state), check.end, true, true)
+        || !checkFreeIndex(&check) || !checkCounters(&check)) {
+        printProblem(&check);
+        return 0;
+    }
+    return 1;
+}
+
+static int checkSlice(void *alloc_state, heapCheckCursor *cursor) {
+    heapCheck check;
+    initCheck(&check, alloc_state);
+    if (!checkHeapState(&check)) {
+        printProblem(&check);
+        cursor->offset = 0;
+        return 0;
+    }
+
+    //resume only if the block the cursor stopped at looks untouched
+    blockHeader *block = getFirstBlock(alloc_state);
+    if (cursor->offset) {
+        blockHeader *saved = (blockHeader *)(check.heap + cursor->offset);
+        if ((char *)saved >= (char *)block && (char *)saved < check.end && !(cursor->offset & 7)
+            && saved->size == cursor->header) {
+            block = saved;
+        } else {
+            cursor->restarts++;
+        }
+    }
+    bool resumed = block != getFirstBlock(alloc_state);
+
+    size_t room = (size_t)(check.end - (char *)block);
+    char *stop = cursor->sliceBytes && cursor->sliceBytes < room ? (char *)block + cursor->sliceBytes : check.end;
+    blockHeader *stopped = checkBlocks(&check, block, stop, !resumed, true);
+    if (!stopped) {
+        if (resumed && cursor->suspect != check.problemOffset) {
+            //the cursor's block may have been merged away since: look again on a fresh pass
+            cursor->suspect = check.problemOffset;
+            cursor->offset = 0;
+            cursor->restarts++;
+            return 1;
+        }
+        printProblem(&check);
+        cursor->offset = 0;
+        cursor->suspect = 0;
+        return 0;
+    }
+
+    if ((char *)stopped == check.end) {
+        cursor->passes++;
+        cursor->offset = 0;
+        cursor->suspect = 0;
+    } else {
+        cursor->offset = (size_t)((char *)stopped - check.heap);
+        cursor->header = stopped->size;
+    }
+    return 1;
+}
+
+/*
+Sampling heap profiler (-DCPEN212_SAMPLE builds). Sampling intervals are drawn from an
+exponential distribution with the requested mean, so every byte allocated is equally likely
+to trigger a sample and big allocations are sampled in proportion to their size. Each sampled
+allocation's call stack is captured with backtrace() and folded into a site keyed by the stack;
+sites count the sampled blocks still allocated and all sampled blocks. The profile is written
+in the legacy text format that pprof reads ("heap_v2"), which carries the sampling interval so
+pprof can scale the samples back up to estimated totals.
+*/
+#ifdef CPEN212_SAMPLE
+#define SAMPLE_DEFAULT_INTERVAL ((size_t)512 * 1024)
+#define SAMPLE_MAX_FRAMES       32
+#define SAMPLE_SKIP_FRAMES      2   // the callback itself and the cpen212_* call that sampled
+                                    // (noteAlloc and noteFree are always inlined into it)
+
+typedef struct sampleSite {
+    void *frames[SAMPLE_MAX_FRAMES];
+    size_t numFrames;
+    uint64_t hash;
+    size_t liveCount, liveBytes;    // sampled blocks from this site still allocated
+    size_t totalCount, totalBytes;  // all sampled blocks from this site
+} sampleSite;
+
+typedef struct liveSample {
+    void *p;                        // NULL if the slot is empty
+    size_t nbytes;
+    size_t site;
+} liveSample;
+
+typedef struct sampleProfile {
+    heapSampler sampler;            // first, so the callbacks can get back to the profile
+    size_t interval;                // mean bytes between samples
+    uint64_t rng;
+    sampleSite *sites;
+    size_t numSites, siteCapacity;
+    size_t *siteTable;              // open-addressed by stack hash: site index + 1, or 0 if empty
+    size_t siteTableSize;           // a power of two, at least twice numSites
+    liveSample *live;               // open-addressed by address
+    size_t numLive, liveTableSize;  // a power of two, at least twice numLive
+} sampleProfile;
+
+static uint64_t hashPointer(const void *p) {
+    return ((uint64_t)(uintptr_t)p >> 3) * 0x9e3779b97f4a7c15ull;
+}
+
+//bytes until the next sample: exponential with mean profile->interval
+static int64_t drawSampleInterval(sampleProfile *profile) {
+    //xorshift64*, then 53 random bits as a uniform double in (0, 1]
+    profile->rng ^= profile->rng >> 12;
+    profile->rng ^= profile->rng << 25;
+    profile->rng ^= profile->rng >> 27;
+    double u = (double)((profile->rng * 0x2545f4914f6cdd1dull >> 11) + 1) / 9007199254740992.0;
+    double bytes = -log(u) * (double)profile->interval;
+    return bytes < 1.0 ? 1 : (int64_t)bytes;
+}
+
+//site index for a stack, adding the site if it is new; SIZE_MAX if memory ran out
+static size_t findSite(sampleProfile *profile, void **frames, size_t numFrames) {
+    uint64_t hash = 14695981039346656037ull; //FNV-1a over the frame addresses
+    for (size_t i = 0; i < numFrames; i++) {
+        hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ull;
+    }
+
+    size_t mask = profile->siteTableSize - 1;
+    size_t slot = hash & mask;
+    for (; profile->siteTable[slot]; slot = (slot + 1) & mask) {
+        sampleSite *site = &profile->sites[profile->siteTable[slot] - 1];
+        if (site->hash == hash && site->numFrames == numFrames
+            && memcmp(site->frames, frames, numFrames * sizeof(void *)) == 0) {
+            return profile->siteTable[slot] - 1;
+        }
+    }
+
+    if (profile->numSites == profile->siteCapacity) {
+        size_t capacity = profile->siteCapacity * 2;
+        sampleSite *sites = realloc(profile->sites, capacity * sizeof(sampleSite));
+        if (!sites) {
+            return SIZE_MAX;
+        }
+        profile->sites = sites;
+        profile->siteCapacity = capacity;
+    }
+    if (2 * (profile->numSites + 1) > profile->siteTableSize) {
+        size_t size = profile->siteTableSize * 2;
+        size_t *table = calloc(size, sizeof(size_t));
+        if (!table) {
+            return SIZE_MAX;
+        }
+        for (size_t i = 0; i < profile->numSites; i++) {
+            size_t s = profile->sites[i].hash & (size - 1);
+            while (table[s]) {
+                s = (s + 1) & (size - 1);
+            }
+            table[s] = i + 1;
+        }
+        free(profile->siteTable);
+        profile->siteTable = table;
+        profile->siteTableSize = size;
+        slot = hash & (size - 1);
+        while (table[slot]) {
+            slot = (slot + 1) & (size - 1);
+        }
+    }
+
+    sampleSite *site = &profile->sites[profile->numSites];
+    memset(site, 0, sizeof(*site));
+    memcpy(site->frames, frames, numFrames * sizeof(void *));
+    site->numFrames = numFrames;
+    site->hash = hash;
+    profile->siteTable[slot] = ++profile->numSites;
+    return profile->numSites - 1;
+}
+
+static bool growLiveTable(sampleProfile *profile) {
+    size_t size = profile->liveTableSize * 2;
+    liveSample *table = calloc(size, sizeof(liveSample));
+    if (!table) {
+        return false;
+    }
+    for (size_t i = 0; i < profile->liveTableSize; i++) {
+        if (profile->live[i].p) {
+            size_t s = hashPointer(profile->live[i].p) & (size - 1);
+            while (table[s].p) {
+                s = (s + 1) & (size - 1);
+            }
+            table[s] = profile->live[i];
+        }
+    }
+    free(profile->live);
+    profile->live = table;
+    profile->liveTableSize = size;
+    return true;
+}
+
+static void sampleAlloc(heapSampler *sampler, void *p, size_t nbytes) {
+    sampleProfile *profile = (sampleProfile *)sampler;
+    sampler->bytesUntilSample = drawSampleInterval(profile);
+
+    void *frames[SAMPLE_MAX_FRAMES + SAMPLE_SKIP_FRAMES];
+    int depth = backtrace(frames, SAMPLE_MAX_FRAMES + SAMPLE_SKIP_FRAMES);
+    size_t skip = depth > SAMPLE_SKIP_FRAMES ? SAMPLE_SKIP_FRAMES : 0;
+    size_t site = findSite(profile, frames + skip, (size_t)depth - skip);
+    if (site == SIZE_MAX || (2 * (profile->numLive + 1) > profile->liveTableSize && !growLiveTable(profile))) {
+        return; //out of memory, so this sample is dropped
+    }
+
+    size_t mask = profile->liveTableSize - 1;
+    size_t slot = hashPointer(p) & mask;
+    while (profile->live[slot].p) {
+        slot = (slot + 1) & mask;
+    }
+    profile->live[slot] = (liveSample){.p = p, .nbytes = nbytes, .site = site};
+    profile->numLive++;
+    sampler->filter[getSampleFilterSlot(p)]++;
+
+    sampleSite *s = &profile->sites[site];
+    s->liveCount++;
+    s->liveBytes += nbytes;
+    s->totalCount++;
+    s->totalBytes += nbytes;
+}
+
+static void sampleFree(heapSampler *sampler, void *p, size_t nbytes) {
+    sampleProfile *profile = (sampleProfile *)sampler;
+    (void)nbytes;
+
+    size_t mask = profile->liveTableSize - 1;
+    size_t slot = hashPointer(p) & mask;
+    while (profile->live[slot].p != p) {
+        if (!profile->live[slot].p) {
+            return; //shares a filter slot with a sampled block, but was not sampled itself
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    sampleSite *site = &profile->sites[profile->live[slot].site];
+    site->liveCount--;
+    site->liveBytes -= profile->live[slot].nbytes;
+    sampler->filter[getSampleFilterSlot(p)]--;
+    profile->numLive--;
+
+    //backward-shift deletion keeps every entry reachable from its home slot
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; profile->live[next].p; next = (next + 1) & mask) {
+        size_t home = hashPointer(profile->live[next].p) & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            profile->live[hole] = profile->live[next];
+            hole = next;
+        }
+    }
+    profile->live[hole].p = NULL;
+}
+
+static void freeSampleProfile(sampleProfile *profile) {
+    free(profile->sites);
+    free(profile->siteTable);
+    free(profile->live);
+    free(profile);
+}
+
+static int startSampling(void *alloc_state, size_t interval) {
+    heapState *state = (heapState *)alloc_state;
+    sampleProfile *profile = calloc(1, sizeof(sampleProfile));
+    if (!profile) {
+        return 0;
+    }
+    profile->interval = interval ? interval : SAMPLE_DEFAULT_INTERVAL;
+    profile->rng = (uint64_t)(uintptr_t)alloc_state | 1;
+    profile->siteCapacity = 64;
+    profile->siteTableSize = 128;
+    profile->liveTableSize = 128;
+    profile->sites = malloc(profile->siteCapacity * sizeof(sampleSite));
+    profile->siteTable = calloc(profile->siteTableSize, sizeof(size_t));
+    profile->live = calloc(profile->liveTableSize, sizeof(liveSample));
+    if (!profile->sites || !profile->siteTable || !profile->live) {
+        freeSampleProfile(profile);
+        return 0;
+    }
+    profile->sampler.bytesUntilSample = drawSampleInterval(profile);
+    profile->sampler.onAlloc = sampleAlloc;
+    profile->sampler.onFree = sampleFree;
+
+    //restarting drops the old profile; blocks it sampled are simply not tracked any more
+    if (state->sampler) {
+        freeSampleProfile((sampleProfile *)state->sampler);
+    }
+    state->sampler = &profile->sampler;
+    return 1;
+}
+
+static int dumpSamples(void *alloc_state, FILE *out) {
+    sampleProfile *profile = (sampleProfile *)((heapState *)alloc_state)->sampler;
+    if (!profile) {
+        return 0;
+    }
+
+    size_t liveCount = 0, liveBytes = 0, totalCount = 0, totalBytes = 0;
+    for (size_t i = 0; i < profile->numSites; i++) {
+        liveCount += profile->sites[i].liveCount;
+        liveBytes += profile->sites[i].liveBytes;
+        totalCount += profile->sites[i].totalCount;
+        totalBytes += profile->sites[i].totalBytes;
+    }
+    fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+            liveCount, liveBytes, totalCount, totalBytes, profile->interval);
+    for (size_t i = 0; i < profile->numSites; i++) {
+        sampleSite *site = &profile->sites[i];
+        fprintf(out, "%zu: %zu [%zu: %zu] @", site->liveCount, site->liveBytes, site->totalCount, site->totalBytes);
+        for (size_t f = 0; f < site->numFrames; f++) {
+            fprintf(out, " %p", site->frames[f]);
+        }
+        fprintf(out, "\n");
+    }
+
+    //pprof maps the addresses back to functions with the process's mappings
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        char buffer[4096];
+        size_t n;
+        fprintf(out, "\nMAPPED_LIBRARIES:\n");
+        while ((n = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+            fwrite(buffer, 1, n, out);
+        }
+        fclose(maps);
+    }
+    fflush(out);
+    return 1;
+}
+
+static int stopSampling(void *alloc_state) {
+    heapState *state = (heapState *)alloc_state;
+    if (!state->sampler) {
+        return 0;
+    }
+    freeSampleProfile((sampleProfile *)state->sampler);
+    state->sampler = NULL;
+    return 1;
+}
+#endif
+
+/*
+Fragmentation map (DEBUG_OP_FRAGMAP_DUMP; the format is described in cpen212common.h).
+This is meant to be called when an allocation fails, so it allocates nothing: runs are
+encoded into a buffer on the stack and handed to write() whenever it fills up. The walk
+is the same chain of header loads as the consistency check, prefetching ahead in the
+same way, but it only checks that each block stays inside the heap.
+*/
+#define FRAGMAP_BUFFER_SIZE 16384
+
+typedef struct fragmapWriter {
+    int fd;
+    bool failed;    // a write failed; the rest of the map is dropped
+    size_t used;
+    uint8_t buffer[FRAGMAP_BUFFER_SIZE];
+} fragmapWriter;
+
+static void flushFragmap(fragmapWriter *writer) {
+    size_t done = 0;
+    while (!writer->failed && done < writer->used) {
+        ssize_t n = write(writer->fd, writer->buffer + done, writer->used - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            writer->failed = true;
+        } else {
+            done += (size_t)n;
+        }
+    }
+    writer->used = 0;
+}
+
+//append an unsigned LEB128 varint (at most 10 bytes)
+static void putFragmapVarint(fragmapWriter *writer, uint64_t value) {
+    if (writer->used > FRAGMAP_BUFFER_SIZE - 10) {
+        flushFragmap(writer);
+    }
+    while (value >= 0x80) {
+        writer->buffer[writer->used++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    writer->buffer[writer->used++] = (uint8_t)value;
+}
+
+//run word of an allocated block: its size, FRAGMAP_ALLOCATED, and FRAGMAP_SLAB for slab pages
+static uint64_t getAllocatedWord(heapState *state, blockHeader *block, size_t size) {
+    slabPage *page = (slabPage *)((char *)block + sizeof(blockHeader));
+    if (state->slabs && !((uintptr_t)page & (SLAB_PAGE_SIZE - 1)) && size >= sizeof(blockHeader) + SLAB_PAGE_SIZE
+        && page->magic == (SLAB_MAGIC ^ (uintptr_t)page)) {
+        return size | FRAGMAP_ALLOCATED | FRAGMAP_SLAB;
+    }
+    return size | FRAGMAP_ALLOCATED;
+}
+
+static int dumpFragmap(void *alloc_state, int fd) {
+    heapState *state = (heapState *)alloc_state;
+    fragmapWriter writer;
+    writer.fd = fd;
+    writer.failed = false;
+    memcpy(writer.buffer, FRAGMAP_MAGIC, FRAGMAP_MAGIC_SIZE);
+    writer.used = FRAGMAP_MAGIC_SIZE;
+    putFragmapVarint(&writer, FRAGMAP_VERSION);
+    putFragmapVarint(&writer, getHeapSize(state));
+    putFragmapVarint(&writer, sizeof(heapState));
+
+    char *end = getHeapEnd(state);
+    char *here = (char *)getFirstBlock(state);
+    uint64_t runWord = 0, runLength = 0;
+    while (here < end) {
+        __builtin_prefetch(here + CHECK_PREFETCH_DISTANCE);
+        blockHeader *block = (blockHeader *)here;
+        size_t size = getBlockSize(block);
+        if (size == 0 || size > (size_t)(end - here)) {
+            break; //a broken header; the map ends here
+        }
+        uint64_t word = isBlockAllocated(block) ? getAllocatedWord(state, block, size) : size;
+        if (word != runWord) {
+            if (runLength) {
+                putFragmapVarint(&writer, runWord);
+                putFragmapVarint(&writer, runLength);
+            }
+            runWord = word;
+            runLength = 0;
+        }
+        runLength++;
+        here += size;
+    }
+    if (runLength) {
+        putFragmapVarint(&writer, runWord);
+        putFragmapVarint(&writer, runLength);
+    }
+    putFragmapVarint(&writer, 0);
+    putFragmapVarint(&writer, (uint64_t)(here - (char *)state));
+    flushFragmap(&writer);
+    return !writer.failed && here == end;
+}
+
+int cpen212_debug_query(void *alloc_state, int op, void *out) {
+    if (!alloc_state || !out) {
+        return 0;
+    }
+    switch (op) {
+    case DEBUG_OP_CHECK_SLICE:
+        return checkSlice(alloc_state, (heapCheckCursor *)out);
+#ifdef CPEN212_STATS
+    case DEBUG_OP_HEAP_STATS:
+        fillHeapReport((heapState *)alloc_state, (heapReport *)out);
+        return 1;
+#endif
+#ifdef CPEN212_SAMPLE
+    case DEBUG_OP_SAMPLE_START:
+        return startSampling(alloc_state, *(size_t *)out);
+    case DEBUG_OP_SAMPLE_DUMP:
+        return dumpSamples(alloc_state, (FILE *)out);
+#endif
+    case DEBUG_OP_FRAGMAP_DUMP:
+        return dumpFragmap(alloc_state, *(int *)out);
+#ifdef CPEN212_PROFILE
+    case DEBUG_OP_PROFILE_REPORT:
+        if (!((heapState *)alloc_state)->profile) {
+            return 0;
+        }
+        memcpy(out, ((heapState *)alloc_state)->profile, sizeof(heapProfile));
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+int cpen212_debug(void *alloc_state, int op) {
+    switch (op) {
+    case 0:
+        return checkHeap(alloc_state);
+    case DEBUG_OP_PLACEMENT_STATS:
+        return printPlacementStats(alloc_state);
+    case DEBUG_OP_HEAP_STATS:
+        return printHeapStats(alloc_state);
+    case DEBUG_OP_PROFILE_START:
+        return startProfile(alloc_state);
+    case DEBUG_OP_PROFILE_REPORT:
+        return printProfile(alloc_state);
+    case DEBUG_OP_PROFILE_STOP:
+        return stopProfile(alloc_state);
+#ifdef CPEN212_SAMPLE
+    case DEBUG_OP_SAMPLE_START:
+        return startSampling(alloc_state, 0);
+    case DEBUG_OP_SAMPLE_DUMP:
+        return dumpSamples(alloc_state, stdout);
+    case DEBUG_OP_SAMPLE_STOP:
+        return stopSampling(alloc_state);
+#else
+    case DEBUG_OP_SAMPLE_START:
+    case DEBUG_OP_SAMPLE_DUMP:
+    case DEBUG_OP_SAMPLE_STOP:
+        printf("heap sampling needs a -DCPEN212_SAMPLE build\n");
+        return 0;
+#endif
+    case DEBUG_OP_FRAGMAP_DUMP:
+        fflush(stdout); //the map goes straight to the descriptor, after anything already printed
+        return dumpFragmap(alloc_state, STDOUT_FILENO);
+    default:
+        return 0;
+    }
 }
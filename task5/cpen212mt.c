@@ -0,0 +1,412 @@
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#ifdef CPEN212_STATS
+#include <time.h>
+#endif
+#include "cpen212alloc.h"
+#include "cpen212common.h"
+#include "cpen212mt.h"
+
+/*
+Shared Heap Layout:
+
+mtHeap (allocated from the heap right after cpen212_init)
+    -heap: the underlying cpen212 heap handle
+    -lock: taken around every call into the cpen212 heap
+    -cacheKey: pthread key holding each thread's threadCache for this heap
+    -remoteFrees: lock-free stack of blocks waiting to go back to the heap,
+     linked through the word after each block's tag
+block handed out by this layer
+    -an mtTag word at the start of the cpen212 payload holding the block's bin
+     (MT_CACHE_CLASSES if it goes back to the heap when freed) and, for a slab
+     slot, the slot size (0 for a regular block); the caller's pointer starts
+     right after it, so it stays 8-byte aligned
+threadCache (one per thread using the heap, also allocated from the heap)
+    -bins[c] is a stack of up to MT_CACHE_DEPTH free blocks
+    -bin c holds blocks with a usable size in [MT_CACHE_MIN_SIZE << c, MT_CACHE_MIN_SIZE << (c + 1)),
+     so any block in it can serve a request of up to MT_CACHE_MIN_SIZE << c bytes
+    -blocks in a cache are still allocated as far as the cpen212 heap is concerned
+
+Requests over MT_CACHE_MIN_SIZE << (MT_CACHE_CLASSES - 1) bytes skip the cache and
+go straight to the heap under the lock. An empty bin is refilled with MT_CACHE_BATCH
+blocks in one locked section, and a full bin gives back its MT_CACHE_BATCH oldest blocks.
+A thread's cache is flushed back to the heap when the thread exits.
+
+Blocks are never freed into the heap directly: uncached frees and bin flushes push
+onto remoteFrees with a single CAS (a whole flushed batch is pushed as one chain), and
+whichever thread next takes the lock drains the stack into the heap, where the blocks
+are coalesced as usual. Only the lock holder pops, and it takes the whole stack at
+once, so the stack has a single consumer and no ABA problem.
+
+A free has to pick the block's bin without the lock, so it cannot look at the block
+header (the lock holder may be rewriting its flag bits) or probe for a slab page (that
+reads a word of some other block). Instead the bin goes into the block's tag when the
+block leaves the heap, under the lock; only the thread that owns the block touches the
+tag after that, and handing the pointer to another thread orders the write before its
+read. Once the block is freed, the word after the tag becomes the remote free stack link
+(every block has room for it, since the smallest request rounds up to a 16-byte slab slot).
+
+The heap's own slab probe has the same problem even under the lock: for a regular
+block it reads the first word of the surrounding 1 KB page, usually part of a block
+some other thread is writing. So this layer always knows which kind of block it has:
+small requests ask for a slab slot first (cpen212_alloc_slot) and fall back to a
+regular block (cpen212_alloc_block), and the tag says which one came back. Slab slots
+go back through cpen212_free, whose probe then only reads their own page header;
+regular blocks are resized and freed with the _block calls, which skip the probe.
+
+With -DCPEN212_STATS the heap also counts lock acquisitions, how many of them found
+the lock taken, and the total time spent waiting; the counters are only written by
+the lock holder, so they need no atomics.
+*/
+
+#define MT_CACHE_CLASSES  8 // bins for 8, 16, 32, ..., 1024 byte requests
+#define MT_CACHE_MIN_SIZE ((size_t)8)
+#define MT_CACHE_DEPTH    32
+#define MT_CACHE_BATCH    16
+
+typedef struct mtTag {
+    uint32_t cacheClass;
+    uint32_t slotSize; //0 for a regular block
+} mtTag;
+
+//a freed block waiting on the remote free stack
+typedef struct remoteBlock {
+    mtTag tag;
+    struct remoteBlock *next;
+} remoteBlock;
+
+typedef struct threadCache {
+    mtHeap *owner;
+    size_t counts[MT_CACHE_CLASSES];
+    void *bins[MT_CACHE_CLASSES][MT_CACHE_DEPTH];
+} threadCache;
+
+struct mtHeap {
+    void *heap;
+    pthread_mutex_t lock;
+    pthread_key_t cacheKey;
+    remoteBlock *remoteFrees; //only accessed with __atomic builtins
+#ifdef CPEN212_STATS
+    uint64_t lockWaitNs;
+    uint64_t lockAcquisitions;
+    uint64_t lockContended;
+#endif
+};
+
+#ifdef CPEN212_STATS
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+
+//smallest bin whose blocks can all hold nbytes, or MT_CACHE_CLASSES if none can
+static size_t getRequestClass(size_t nbytes) {
+    if (nbytes <= MT_CACHE_MIN_SIZE) {
+        return 0;
+    }
+    size_t cacheClass = (size_t)(64 - __builtin_clzl(nbytes - 1)) - 3; //ceil(log2(nbytes)) - 3
+    return cacheClass < MT_CACHE_CLASSES ? cacheClass : MT_CACHE_CLASSES;
+}
+
+//bin for a block with usableSize bytes, or MT_CACHE_CLASSES if it should go back to the heap
+static size_t getBlockClass(size_t usableSize) {
+    if (usableSize < MT_CACHE_MIN_SIZE) {
+        return MT_CACHE_CLASSES;
+    }
+    size_t cacheClass = (size_t)(63 - __builtin_clzl(usableSize)) - 3; //floor(log2(usableSize)) - 3
+    return cacheClass < MT_CACHE_CLASSES ? cacheClass : MT_CACHE_CLASSES;
+}
+
+//tag a block just taken from the heap (with the lock held) and return the caller's pointer;
+//slotSize is the slab slot size, or 0 for a regular block
+static void *tagBlock(void *block, size_t cacheClass, size_t slotSize) {
+    if (cacheClass == MT_CACHE_CLASSES) {
+        //any block big enough may still serve a cached size later; a regular block's
+        //size is read from its header, since probing for a slab page would race
+        size_t usableSize = slotSize ? slotSize
+                                     : getBlockSize((blockHeader *)((char *)block - sizeof(blockHeader))) - sizeof(blockHeader);
+        cacheClass = getBlockClass(usableSize - sizeof(mtTag));
+    }
+    *(mtTag *)block = (mtTag){.cacheClass = (uint32_t)cacheClass, .slotSize = (uint32_t)slotSize};
+    return (char *)block + sizeof(mtTag);
+}
+
+static void *getTaggedBlock(void *p) {
+    return (char *)p - sizeof(mtTag);
+}
+
+//bytes to ask the heap for to hand out nbytes, or 0 if that overflows
+static size_t getHeapRequest(size_t nbytes) {
+    return nbytes > SIZE_MAX - sizeof(mtTag) ? 0 : nbytes + sizeof(mtTag);
+}
+
+//take a block for nbytes from the heap (with the lock held): a slab slot if it is small
+//enough and one is free, a regular block otherwise; returns the tagged caller's pointer
+static void *takeBlock(mtHeap *heap, size_t nbytes, size_t cacheClass) {
+    size_t request = getHeapRequest(nbytes);
+    void *block = request <= SLAB_MAX_SIZE ? cpen212_alloc_slot(heap->heap, request) : NULL;
+    if (block) {
+        return tagBlock(block, cacheClass, getUsableSize(heap->heap, block));
+    }
+    block = cpen212_alloc_block(heap->heap, request);
+    return block ? tagBlock(block, cacheClass, 0) : NULL;
+}
+
+//push the chain first..last onto the remote free stack
+static void pushRemoteFrees(mtHeap *heap, remoteBlock *first, remoteBlock *last) {
+    remoteBlock *top = __atomic_load_n(&heap->remoteFrees, __ATOMIC_RELAXED);
+    do {
+        last->next = top;
+    } while (!__atomic_compare_exchange_n(&heap->remoteFrees, &top, first, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//take the heap lock and free everything pushed onto the remote free stack so far
+static void lockHeap(mtHeap *heap) {
+#ifdef CPEN212_STATS
+    if (pthread_mutex_trylock(&heap->lock) != 0) {
+        uint64_t start = nowNs();
+        pthread_mutex_lock(&heap->lock);
+        heap->lockWaitNs += nowNs() - start;
+        heap->lockContended++;
+    }
+    heap->lockAcquisitions++;
+#else
+    pthread_mutex_lock(&heap->lock);
+#endif
+    if (!__atomic_load_n(&heap->remoteFrees, __ATOMIC_RELAXED)) {
+        return;
+    }
+    remoteBlock *block = __atomic_exchange_n(&heap->remoteFrees, NULL, __ATOMIC_ACQUIRE);
+    while (block) {
+        remoteBlock *next = block->next;
+        if (block->tag.slotSize) {
+            cpen212_free(heap->heap, block);
+        } else {
+            cpen212_free_block(heap->heap, block);
+        }
+        block = next;
+    }
+}
+
+static void unlockHeap(mtHeap *heap) {
+    pthread_mutex_unlock(&heap->lock);
+}
+
+//give count blocks from the bottom (oldest end) of bin cacheClass back to the heap
+static void flushBin(mtHeap *heap, threadCache *cache, size_t cacheClass, size_t count) {
+    assert(count > 0 && count <= cache->counts[cacheClass]);
+
+    void **bin = cache->bins[cacheClass];
+    for (size_t i = 0; i + 1 < count; i++) {
+        ((remoteBlock *)getTaggedBlock(bin[i]))->next = (remoteBlock *)getTaggedBlock(bin[i + 1]);
+    }
+    pushRemoteFrees(heap, (remoteBlock *)getTaggedBlock(bin[0]), (remoteBlock *)getTaggedBlock(bin[count - 1]));
+
+    cache->counts[cacheClass] -= count;
+    memmove(bin, bin + count,
+            cache->counts[cacheClass] * sizeof(void *));
+}
+
+//fill an empty bin with up to MT_CACHE_BATCH blocks of the bin's size
+static void refillBin(mtHeap *heap, threadCache *cache, size_t cacheClass) {
+    size_t blockSize = MT_CACHE_MIN_SIZE << cacheClass;
+
+    assert(cache->counts[cacheClass] == 0);
+
+    lockHeap(heap);
+    while (cache->counts[cacheClass] < MT_CACHE_BATCH) {
+        void *p = takeBlock(heap, blockSize, cacheClass);
+        if (!p) {
+            break;
+        }
+        cache->bins[cacheClass][cache->counts[cacheClass]++] = p;
+    }
+    unlockHeap(heap);
+}
+
+static void flushCache(mtHeap *heap, threadCache *cache) {
+    for (size_t i = 0; i < MT_CACHE_CLASSES; i++) {
+        if (cache->counts[i]) {
+            flushBin(heap, cache, i, cache->counts[i]);
+        }
+    }
+}
+
+//pthread key destructor: runs when a thread that used the heap exits
+static void destroyCache(void *arg) {
+    threadCache *cache = (threadCache *)arg;
+    mtHeap *heap = cache->owner;
+
+    flushCache(heap, cache);
+    remoteBlock *block = (remoteBlock *)getTaggedBlock(cache);
+    pushRemoteFrees(heap, block, block);
+}
+
+//the calling thread's cache for heap, made on first use; NULL if the heap has no room for one
+static threadCache *getThreadCache(mtHeap *heap) {
+    threadCache *cache = (threadCache *)pthread_getspecific(heap->cacheKey);
+    if (cache) {
+        return cache;
+    }
+
+    lockHeap(heap);
+    cache = (threadCache *)takeBlock(heap, sizeof(threadCache), MT_CACHE_CLASSES);
+    unlockHeap(heap);
+    if (!cache) {
+        return NULL;
+    }
+
+    memset(cache, 0, sizeof(threadCache));
+    cache->owner = heap;
+    if (pthread_setspecific(heap->cacheKey, cache) != 0) {
+        remoteBlock *block = (remoteBlock *)getTaggedBlock(cache);
+        pushRemoteFrees(heap, block, block);
+        return NULL;
+    }
+    return cache;
+}
+
+mtHeap *cpen212_mt_init(void *heap_start, void *heap_end) {
+    void *handle = cpen212_init(heap_start, heap_end);
+    if (!handle) {
+        return NULL;
+    }
+
+    mtHeap *heap = (mtHeap *)cpen212_alloc(handle, sizeof(mtHeap));
+    if (!heap) {
+        return NULL;
+    }
+    heap->heap = handle;
+    heap->remoteFrees = NULL;
+#ifdef CPEN212_STATS
+    heap->lockWaitNs = 0;
+    heap->lockAcquisitions = 0;
+    heap->lockContended = 0;
+#endif
+    if (pthread_mutex_init(&heap->lock, NULL) != 0) {
+        return NULL;
+    }
+    if (pthread_key_create(&heap->cacheKey, destroyCache) != 0) {
+        pthread_mutex_destroy(&heap->lock);
+        return NULL;
+    }
+    return heap;
+}
+
+void cpen212_mt_destroy(mtHeap *heap) {
+    threadCache *cache = (threadCache *)pthread_getspecific(heap->cacheKey);
+    if (cache) {
+        pthread_setspecific(heap->cacheKey, NULL);
+        destroyCache(cache);
+    }
+    lockHeap(heap);
+    unlockHeap(heap);
+    pthread_key_delete(heap->cacheKey);
+    pthread_mutex_destroy(&heap->lock);
+}
+
+void *cpen212_mt_alloc(mtHeap *heap, size_t nbytes) {
+    if (!heap || nbytes == 0 || getHeapRequest(nbytes) == 0) {
+        return NULL;
+    }
+
+    size_t cacheClass = getRequestClass(nbytes);
+    threadCache *cache = cacheClass < MT_CACHE_CLASSES ? getThreadCache(heap) : NULL;
+    if (cache) {
+        if (cache->counts[cacheClass] == 0) {
+            refillBin(heap, cache, cacheClass);
+        }
+        if (cache->counts[cacheClass] > 0) {
+            return cache->bins[cacheClass][--cache->counts[cacheClass]];
+        }
+        //the heap has no room for a block of the full bin size, but may still fit nbytes
+    }
+
+    lockHeap(heap);
+    void *p = takeBlock(heap, nbytes, MT_CACHE_CLASSES);
+    unlockHeap(heap);
+    return p;
+}
+
+void cpen212_mt_free(mtHeap *heap, void *p) {
+    if (!heap || !p) {
+        return;
+    }
+
+    size_t cacheClass = ((mtTag *)getTaggedBlock(p))->cacheClass;
+    threadCache *cache = cacheClass < MT_CACHE_CLASSES ? getThreadCache(heap) : NULL;
+    if (cache) {
+        if (cache->counts[cacheClass] == MT_CACHE_DEPTH) {
+            flushBin(heap, cache, cacheClass, MT_CACHE_BATCH);
+        }
+        cache->bins[cacheClass][cache->counts[cacheClass]++] = p;
+        return;
+    }
+
+    remoteBlock *block = (remoteBlock *)getTaggedBlock(p);
+    pushRemoteFrees(heap, block, block);
+}
+
+void *cpen212_mt_realloc(mtHeap *heap, void *prev, size_t nbytes) {
+    if (!heap) {
+        return NULL;
+    }
+    if (!prev) {
+        return cpen212_mt_alloc(heap, nbytes);
+    }
+    if (nbytes == 0 || getHeapRequest(nbytes) == 0) {
+        return NULL; //prev stays allocated
+    }
+
+    //slab slots cannot grow, so one that is too small moves like any other copy
+    size_t slotSize = ((mtTag *)getTaggedBlock(prev))->slotSize;
+    if (slotSize) {
+        size_t oldSize = slotSize - sizeof(mtTag);
+        if (nbytes <= oldSize) {
+            return prev;
+        }
+        void *p = cpen212_mt_alloc(heap, nbytes);
+        if (p) {
+            memcpy(p, prev, oldSize);
+            cpen212_mt_free(heap, prev);
+        }
+        return p;
+    }
+
+    //resizing a regular block may need the neighbouring blocks, so it goes through the heap
+    lockHeap(heap);
+    void *block = cpen212_realloc_block(heap->heap, getTaggedBlock(prev), getHeapRequest(nbytes));
+    void *p = block ? tagBlock(block, MT_CACHE_CLASSES, 0) : NULL;
+    unlockHeap(heap);
+    return p;
+}
+
+void cpen212_mt_flush(mtHeap *heap) {
+    threadCache *cache = (threadCache *)pthread_getspecific(heap->cacheKey);
+    if (cache) {
+        flushCache(heap, cache);
+    }
+    lockHeap(heap);
+    unlockHeap(heap);
+}
+
+void *cpen212_mt_handle(mtHeap *heap) {
+    return heap->heap;
+}
+
+void cpen212_mt_lock_stats(mtHeap *heap, uint64_t *waitNs, uint64_t *acquisitions, uint64_t *contended) {
+#ifdef CPEN212_STATS
+    lockHeap(heap);
+    *waitNs = heap->lockWaitNs;
+    *acquisitions = heap->lockAcquisitions - 1; //not counting this one
+    *contended = heap->lockContended;
+    unlockHeap(heap);
+#else
+    (void)heap;
+    *waitNs = *acquisitions = *contended = 0;
+#endif
+}
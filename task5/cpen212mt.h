@@ -0,0 +1,73 @@
+#ifndef __CPEN212MT_H__
+#define __CPEN212MT_H__
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Thread-safe layer over a cpen212 heap.
+//
+// The heap itself is not thread-safe, so every call into it goes through one lock.
+// On top of that each thread keeps a bounded cache of recently freed blocks per
+// size class, so most alloc/free pairs never take the lock; caches are refilled
+// from and flushed to the heap in batches. Frees that do reach the heap (from any
+// thread) are pushed onto a lock-free stack with one CAS and merged into the heap
+// by the next thread to take the lock, so no free ever waits for the lock.
+//
+// This layer uses pthreads and thread-specific data, so it lives outside the
+// allocator proper (cpen212alloc.c may not use global or thread-local state).
+
+typedef struct mtHeap mtHeap;
+
+// description:
+// - initialize a heap over [heap_start, heap_end) that may be shared between threads
+// arguments:
+// - heap_start, heap_end: as for cpen212_init
+// returns:
+// - the shared heap, or NULL if the heap could not be set up
+//   (the mtHeap itself is allocated from the start of the heap)
+mtHeap *cpen212_mt_init(void *heap_start, void *heap_end);
+
+// description:
+// - release the lock and thread cache key of a shared heap
+// other:
+// - every other thread must have called cpen212_mt_flush (or exited) first;
+//   the calling thread's cache is flushed here
+void cpen212_mt_destroy(mtHeap *heap);
+
+// description:
+// - thread-safe cpen212_alloc, served from the calling thread's cache when possible
+void *cpen212_mt_alloc(mtHeap *heap, size_t nbytes);
+
+// description:
+// - thread-safe cpen212_free; p may have been allocated by any thread
+void cpen212_mt_free(mtHeap *heap, void *p);
+
+// description:
+// - thread-safe cpen212_realloc
+void *cpen212_mt_realloc(mtHeap *heap, void *prev, size_t nbytes);
+
+// description:
+// - return every block in the calling thread's cache to the shared heap,
+//   along with any pending frees from other threads
+void cpen212_mt_flush(mtHeap *heap);
+
+// description:
+// - the underlying cpen212 heap handle, e.g. for cpen212_debug
+// other:
+// - the caller must make sure no other thread is using the heap meanwhile
+// - blocks from this layer start one word into their cpen212 blocks, so their
+//   pointers cannot be passed to cpen212_free, cpen212_usable_size and the like
+void *cpen212_mt_handle(mtHeap *heap);
+
+// description:
+// - report how contended the heap lock has been so far
+// arguments:
+// - waitNs: set to the total time threads spent waiting for the lock, in nanoseconds
+// - acquisitions: set to the number of times the lock was taken
+// - contended: set to how many of those found it already taken
+// other:
+// - the counters are only kept in -DCPEN212_STATS builds; otherwise all three are 0
+void cpen212_mt_lock_stats(mtHeap *heap, uint64_t *waitNs, uint64_t *acquisitions, uint64_t *contended);
+
+#endif // __CPEN212MT_H__
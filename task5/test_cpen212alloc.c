@@ -0,0 +1,240 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpen212alloc.h"
+#include "cpen212common.h"
+
+// Single-threaded test of the extensions in cpen212common.h: batch alloc/free, memalign,
+// calloc over known-zero memory, try_expand/usable_size, extend and purge. Every step
+// checks the block contents it relies on and then runs the heap consistency check
+// (cpen212_debug op 0). Build and run it with "make test".
+
+#define HEAP_SIZE  (1024 * 1024)
+#define PAGE_SIZE  ((size_t)4096)
+#define NUM_BATCH  64
+
+static bool failed = false;
+
+static void expect(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "failed: %s\n", what);
+        failed = true;
+    }
+}
+
+static void checkHeap(void *heap, const char *after) {
+    if (cpen212_debug(heap, 0) == 0) {
+        fprintf(stderr, "heap check failed after %s\n", after);
+        failed = true;
+    }
+}
+
+static bool isFilled(const unsigned char *p, size_t size, unsigned char fill) {
+    for (size_t i = 0; i < size; i++) {
+        if (p[i] != fill) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testBatch(char *memory) {
+    void *heap = cpen212_init(memory, memory + HEAP_SIZE);
+    const size_t sizes[] = {24, 100};
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        void *blocks[NUM_BATCH], *evens[NUM_BATCH];
+        size_t n = cpen212_alloc_batch(heap, sizes[s], NUM_BATCH, blocks);
+        expect(n == NUM_BATCH, "cpen212_alloc_batch makes every block");
+        for (size_t i = 0; i < n; i++) {
+            memset(blocks[i], (int)i, sizes[s]);
+        }
+        checkHeap(heap, "cpen212_alloc_batch");
+
+        //free every other block (with NULLs in between), then make sure the rest are untouched
+        for (size_t i = 0; i < n; i++) {
+            evens[i] = i % 2 == 0 ? blocks[i] : NULL;
+        }
+        cpen212_free_batch(heap, evens, n);
+        checkHeap(heap, "cpen212_free_batch of half the blocks");
+        for (size_t i = 1; i < n; i += 2) {
+            expect(isFilled(blocks[i], sizes[s], (unsigned char)i), "cpen212_free_batch leaves other blocks alone");
+            evens[i / 2] = blocks[i];
+        }
+        cpen212_free_batch(heap, evens, n / 2);
+        checkHeap(heap, "cpen212_free_batch of the rest");
+    }
+
+    //everything was freed, so the blocks must have coalesced back into one large extent
+    void *p = cpen212_alloc(heap, HEAP_SIZE / 2);
+    expect(p != NULL, "cpen212_free_batch coalesces");
+    cpen212_free(heap, p);
+    checkHeap(heap, "freeing the coalesced block");
+}
+
+static void testMemalign(char *memory) {
+    void *heap = cpen212_init(memory, memory + HEAP_SIZE);
+    void *blocks[16];
+    size_t numBlocks = 0;
+
+    for (size_t alignment = 8; alignment <= PAGE_SIZE; alignment *= 2) {
+        size_t size = 100 + alignment;
+        unsigned char *p = cpen212_memalign(heap, alignment, size);
+        expect(p != NULL, "cpen212_memalign allocates");
+        if (!p) {
+            continue;
+        }
+        expect((uintptr_t)p % alignment == 0, "cpen212_memalign aligns");
+        memset(p, (int)alignment, size);
+        blocks[numBlocks++] = p;
+        checkHeap(heap, "cpen212_memalign");
+    }
+    expect(cpen212_memalign(heap, 48, 100) == NULL, "cpen212_memalign rejects a non-power-of-two alignment");
+
+    //an aligned block can be reallocated and freed like any other
+    unsigned char *p = cpen212_realloc(heap, blocks[0], 4000);
+    expect(p && isFilled(p, 108, 8), "cpen212_realloc keeps an aligned block's data");
+    if (p) {
+        blocks[0] = p;
+    }
+    checkHeap(heap, "cpen212_realloc of an aligned block");
+    for (size_t i = 0; i < numBlocks; i++) {
+        cpen212_free(heap, blocks[i]);
+        checkHeap(heap, "freeing an aligned block");
+    }
+}
+
+static void testCalloc(char *memory) {
+    memset(memory, 0, HEAP_SIZE);
+    void *heap = cpen212_init_zeroed(memory, memory + HEAP_SIZE, POLICY_FIRST_FIT);
+
+    //fresh blocks come from known-zero memory, so they are not cleared again
+    unsigned char *p = cpen212_calloc(heap, 100, 8);
+    expect(p && isFilled(p, 800, 0), "cpen212_calloc over fresh memory is zero");
+    checkHeap(heap, "cpen212_calloc over fresh memory");
+
+    //a used block has lost its known-zero bit and must be cleared
+    memset(p, 0xff, 800);
+    cpen212_free(heap, p);
+    checkHeap(heap, "freeing a dirty block");
+    p = cpen212_calloc(heap, 100, 8);
+    expect(p && isFilled(p, 800, 0), "cpen212_calloc of a reused block is zero");
+    checkHeap(heap, "cpen212_calloc of a reused block");
+
+    expect(cpen212_calloc(heap, SIZE_MAX / 2, 4) == NULL, "cpen212_calloc rejects an overflowing size");
+    expect(cpen212_calloc(heap, 0, 8) == NULL, "cpen212_calloc rejects a zero size");
+    cpen212_free(heap, p);
+    checkHeap(heap, "freeing a calloc block");
+}
+
+static void testExpand(char *memory) {
+    void *heap = cpen212_init(memory, memory + HEAP_SIZE);
+    unsigned char *p = cpen212_alloc(heap, 100);
+    void *next = cpen212_alloc(heap, 200);
+    void *guard = cpen212_alloc(heap, 100);
+    expect(p && next && guard, "setting up blocks to expand");
+    if (!p || !next || !guard) {
+        return;
+    }
+
+    size_t usable = cpen212_usable_size(heap, p);
+    expect(usable >= 100, "cpen212_usable_size covers the request");
+    expect(cpen212_usable_size(heap, NULL) == 0, "cpen212_usable_size of NULL is 0");
+    memset(p, 0x5a, usable);
+
+    //the successor is allocated, so there is no room to grow into
+    expect(cpen212_try_expand(heap, p, usable + 200, usable + 200) == 0, "cpen212_try_expand fails without room");
+    expect(cpen212_usable_size(heap, p) == usable, "a failed cpen212_try_expand leaves the block alone");
+    checkHeap(heap, "a failed cpen212_try_expand");
+
+    cpen212_free(heap, next);
+    size_t expanded = cpen212_try_expand(heap, p, usable + 100, usable + 150);
+    expect(expanded >= usable + 100, "cpen212_try_expand grows into a free successor");
+    expect(cpen212_usable_size(heap, p) == expanded, "cpen212_usable_size matches cpen212_try_expand");
+    expect(isFilled(p, usable, 0x5a), "cpen212_try_expand keeps the data");
+    memset(p, 0xa5, expanded);
+    checkHeap(heap, "cpen212_try_expand");
+
+    cpen212_free(heap, p);
+    cpen212_free(heap, guard);
+    checkHeap(heap, "freeing expanded blocks");
+}
+
+static void testExtend(char *memory) {
+    void *heap = cpen212_init(memory, memory + HEAP_SIZE / 2);
+    size_t before = 0;
+    while (cpen212_alloc(heap, 4096)) {
+        before++;
+    }
+    checkHeap(heap, "filling the heap");
+
+    expect(cpen212_extend(heap, memory + HEAP_SIZE), "cpen212_extend grows the heap");
+    checkHeap(heap, "cpen212_extend");
+    expect(!cpen212_extend(heap, memory + HEAP_SIZE), "cpen212_extend rejects an end that is not past the heap");
+
+    size_t after = 0;
+    while (cpen212_alloc(heap, 4096)) {
+        after++;
+    }
+    expect(after >= before, "cpen212_extend adds usable space");
+    checkHeap(heap, "filling the extended heap");
+}
+
+//stands in for madvise(MADV_DONTNEED): the pages read back as zero
+static void zeroPages(void *ctx, void *start, size_t length) {
+    expect((uintptr_t)start % PAGE_SIZE == 0 && length % PAGE_SIZE == 0, "cpen212_purge passes whole pages");
+    memset(start, 0, length);
+    *(size_t *)ctx += length;
+}
+
+static void testPurge(char *memory) {
+    void *heap = cpen212_init(memory, memory + HEAP_SIZE);
+    void *big = cpen212_alloc(heap, 256 * 1024);
+    void *guard = cpen212_alloc(heap, 100);
+    expect(big && guard, "setting up blocks to purge");
+    if (!big || !guard) {
+        return;
+    }
+    memset(big, 0xab, 256 * 1024);
+    cpen212_free(heap, big);
+
+    size_t zeroed = 0;
+    size_t purged = cpen212_purge(heap, PAGE_SIZE, zeroPages, &zeroed);
+    expect(purged > 0 && purged == zeroed, "cpen212_purge reports the pages it passed on");
+    checkHeap(heap, "cpen212_purge");
+
+    zeroed = 0;
+    expect(cpen212_purge(heap, PAGE_SIZE, zeroPages, &zeroed) == 0 && zeroed == 0,
+           "cpen212_purge skips blocks purged before");
+
+    unsigned char *p = cpen212_alloc(heap, 200 * 1024);
+    expect(p != NULL, "allocating from purged memory");
+    if (p) {
+        memset(p, 0x3c, 200 * 1024);
+        checkHeap(heap, "allocating from purged memory");
+        cpen212_free(heap, p);
+    }
+    cpen212_free(heap, guard);
+    checkHeap(heap, "freeing after cpen212_purge");
+}
+
+int main(void) {
+    char *memory = aligned_alloc(PAGE_SIZE, HEAP_SIZE);
+    if (!memory) {
+        fprintf(stderr, "cannot set up the heap\n");
+        return 1;
+    }
+
+    testBatch(memory);
+    testMemalign(memory);
+    testCalloc(memory);
+    testExpand(memory);
+    testExtend(memory);
+    testPurge(memory);
+    free(memory);
+
+    printf("%s: batch, memalign, calloc, try_expand, extend and purge\n", failed ? "FAILED" : "passed");
+    return failed ? 1 : 0;
+}
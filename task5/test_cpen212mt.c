@@ -0,0 +1,194 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpen212alloc.h"
+#include "cpen212mt.h"
+
+// Stress test for the thread-safe heap layer: every thread allocates, reallocates and
+// frees its own blocks, and hands some of them to the next thread to free (cross-thread
+// frees through the remote free stack). Build it with "make test_cpen212mt", which
+// turns on -fsanitize=thread, so any data race fails the run.
+
+#define NUM_THREADS 4
+#define NUM_OPS     20000
+#define NUM_SLOTS   256
+#define HANDOFF_SIZE 64
+#define HEAP_SIZE   (16 * 1024 * 1024)
+
+typedef struct block {
+    unsigned char *p;
+    size_t size;
+    unsigned char fill;
+} block;
+
+// blocks passed from one thread to the next
+typedef struct handoff {
+    pthread_mutex_t lock;
+    block blocks[HANDOFF_SIZE];
+    size_t count;
+} handoff;
+
+typedef struct worker {
+    mtHeap *heap;
+    size_t index;
+    uint64_t rng;
+    handoff *inbox, *outbox;
+    bool failed;
+} worker;
+
+static uint64_t nextRandom(worker *w) {
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return w->rng * 0x2545f4914f6cdd1dull;
+}
+
+// mostly sizes the thread caches serve, some that go to the heap
+static size_t getRandomSize(worker *w) {
+    uint64_t r = nextRandom(w);
+    return r % 8 ? 1 + r % 1024 : 1025 + r % 8192;
+}
+
+static bool checkBlock(worker *w, block *b) {
+    for (size_t i = 0; i < b->size; i++) {
+        if (b->p[i] != b->fill) {
+            fprintf(stderr, "thread %zu: block %p was overwritten at byte %zu\n", w->index, (void *)b->p, i);
+            w->failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool makeBlock(worker *w, block *b, size_t size) {
+    b->p = cpen212_mt_alloc(w->heap, size);
+    if (!b->p) {
+        fprintf(stderr, "thread %zu: could not allocate %zu bytes\n", w->index, size);
+        w->failed = true;
+        return false;
+    }
+    b->size = size;
+    b->fill = (unsigned char)nextRandom(w);
+    memset(b->p, b->fill, size);
+    return true;
+}
+
+static void freeBlock(worker *w, block *b) {
+    checkBlock(w, b);
+    cpen212_mt_free(w->heap, b->p);
+    b->p = NULL;
+}
+
+// free whatever the previous thread handed over
+static void drainInbox(worker *w) {
+    pthread_mutex_lock(&w->inbox->lock);
+    for (size_t i = 0; i < w->inbox->count; i++) {
+        freeBlock(w, &w->inbox->blocks[i]);
+    }
+    w->inbox->count = 0;
+    pthread_mutex_unlock(&w->inbox->lock);
+}
+
+// pass b to the next thread to free; false if its inbox is full
+static bool handOff(worker *w, block *b) {
+    pthread_mutex_lock(&w->outbox->lock);
+    bool room = w->outbox->count < HANDOFF_SIZE;
+    if (room) {
+        w->outbox->blocks[w->outbox->count++] = *b;
+        b->p = NULL;
+    }
+    pthread_mutex_unlock(&w->outbox->lock);
+    return room;
+}
+
+static void *runWorker(void *arg) {
+    worker *w = (worker *)arg;
+    block slots[NUM_SLOTS] = {0};
+
+    for (size_t op = 0; op < NUM_OPS && !w->failed; op++) {
+        block *b = &slots[nextRandom(w) % NUM_SLOTS];
+        if (!b->p) {
+            makeBlock(w, b, getRandomSize(w));
+        } else if (nextRandom(w) % 4 == 0) {
+            if (!checkBlock(w, b)) {
+                break;
+            }
+            size_t size = getRandomSize(w);
+            unsigned char *p = cpen212_mt_realloc(w->heap, b->p, size);
+            if (!p) {
+                fprintf(stderr, "thread %zu: could not reallocate to %zu bytes\n", w->index, size);
+                w->failed = true;
+                break;
+            }
+            memset(p + (size < b->size ? size : b->size), b->fill, size > b->size ? size - b->size : 0);
+            b->p = p;
+            b->size = size;
+        } else if (nextRandom(w) % 2 == 0 || !handOff(w, b)) {
+            freeBlock(w, b);
+        }
+        if (op % 64 == 0) {
+            drainInbox(w);
+        }
+    }
+
+    for (size_t i = 0; i < NUM_SLOTS; i++) {
+        if (slots[i].p) {
+            freeBlock(w, &slots[i]);
+        }
+    }
+    cpen212_mt_flush(w->heap);
+    return NULL;
+}
+
+int main(void) {
+    char *memory = malloc(HEAP_SIZE);
+    mtHeap *heap = memory ? cpen212_mt_init(memory, memory + HEAP_SIZE) : NULL;
+    if (!heap) {
+        fprintf(stderr, "cannot set up the heap\n");
+        return 1;
+    }
+
+    handoff boxes[NUM_THREADS];
+    worker workers[NUM_THREADS];
+    for (size_t i = 0; i < NUM_THREADS; i++) {
+        pthread_mutex_init(&boxes[i].lock, NULL);
+        boxes[i].count = 0;
+    }
+    for (size_t i = 0; i < NUM_THREADS; i++) {
+        workers[i] = (worker){.heap = heap, .index = i, .rng = 212 + i,
+                              .inbox = &boxes[i], .outbox = &boxes[(i + 1) % NUM_THREADS]};
+    }
+
+    pthread_t threads[NUM_THREADS];
+    for (size_t i = 0; i < NUM_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, runWorker, &workers[i]) != 0) {
+            fprintf(stderr, "cannot start thread %zu\n", i);
+            return 1;
+        }
+    }
+    bool failed = false;
+    for (size_t i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        failed |= workers[i].failed;
+    }
+
+    // blocks handed off after their receiver finished are freed from here
+    for (size_t i = 0; i < NUM_THREADS; i++) {
+        drainInbox(&workers[i]);
+        failed |= workers[i].failed;
+    }
+    cpen212_mt_flush(heap);
+
+    if (cpen212_debug(cpen212_mt_handle(heap), 0) == 0) {
+        fprintf(stderr, "heap check failed\n");
+        failed = true;
+    }
+    cpen212_mt_destroy(heap);
+    free(memory);
+
+    printf("%s: %d threads, %d ops each\n", failed ? "FAILED" : "passed", NUM_THREADS, NUM_OPS);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,492 @@
+// Microbenchmarks for the cpen212 allocators and glibc malloc.
+//
+// Each kernel runs one allocation pattern against a fresh heap of each requested size:
+//
+//     lifo      fill a stack of small blocks, then free it newest first
+//     fifo      free the oldest block of a ring and allocate a new one in its place
+//     random    allocate or free a random slot, with log-uniform sizes
+//     realloc   grow many buffers by repeated realloc, restarting them when they get large
+//     fragment  fill with small blocks, free every other one, then ask for large blocks
+//
+// The number of live blocks scales with the heap size, so small heaps stay within
+// their capacity and large heaps get long free lists. All randomness comes from a
+// fixed seed, so every allocator sees exactly the same calls.
+//
+// Each kernel is run twice: once timed (cycles from the TSC where there is one), and
+// once more with the same calls to measure the peak footprint without slowing down
+// the timed run. For a cpen212 heap the footprint is how far into the heap any block
+// reached; for glibc it is the peak of mallinfo2's arena and mmapped bytes.
+//
+// Output is one CSV line per kernel and heap size:
+//
+//     allocator,kernel,heap_bytes,ops,cycles_per_op,ns_per_op,peak_footprint_bytes,failed_allocs
+//
+// usage: cpen212bench [-H] [-k kernel,...] [-s size,...] [-n ops] [-t seconds] [-r seed]
+//   -H          print the CSV header line first
+//   -k kernels  kernels to run (default: all)
+//   -s sizes    heap sizes, with optional K/M/G suffixes (default: 64K,1M,64M,1G)
+//   -n ops      stop each kernel after this many calls (default: 1000000)
+//   -t seconds  stop each kernel after about this long (default: 2); the calls made so far count
+//   -r seed     random seed (default: 212)
+//
+// Build every allocator's benchmark with "make" in this directory, or run them all with
+// "make bench", which writes bench-results.csv.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#ifdef BENCH_GLIBC
+#include <malloc.h>
+#else
+#include "cpen212alloc.h"
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef BENCH_ALLOCATOR
+#define BENCH_ALLOCATOR "cpen212"
+#endif
+
+#define DEFAULT_OPS     1000000
+#define DEFAULT_SECONDS 2.0
+#define DEFAULT_SEED    212
+#define MAX_LIVE_BLOCKS ((size_t)1 << 16)
+#define TIME_CHECK_OPS  1024 // calls between deadline checks
+#define GLIBC_FOOTPRINT_SAMPLE_OPS 64
+
+typedef struct benchContext {
+    void *heap;             // allocator handle
+    char *heapStart;
+    size_t heapSize;
+    uint64_t rng;
+    size_t ops, opLimit;
+    uint64_t deadlineNs;    // 0 for none
+    bool stopped;           // the op limit or deadline was reached
+    size_t stoppedAt;       // ops when it was
+    bool trackFootprint;
+    size_t peakFootprint;
+    size_t failed;
+} benchContext;
+
+typedef void (*benchKernel)(benchContext *ctx);
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t readCycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return nowNs(); //no cycle counter; report nanoseconds instead
+#endif
+}
+
+//xorshift64*
+static uint64_t nextRandom(benchContext *ctx) {
+    ctx->rng ^= ctx->rng >> 12;
+    ctx->rng ^= ctx->rng << 25;
+    ctx->rng ^= ctx->rng >> 27;
+    return ctx->rng * 0x2545f4914f6cdd1dull;
+}
+
+static size_t getRandomBetween(benchContext *ctx, size_t low, size_t high) {
+    return low + (size_t)(nextRandom(ctx) % (high - low + 1));
+}
+
+//log-uniform in [low, high]: as many blocks in [8, 16) as in [2048, 4096)
+static size_t getRandomSize(benchContext *ctx, size_t low, size_t high) {
+    unsigned lowBits = 63 - (unsigned)__builtin_clzll(low);
+    unsigned highBits = 63 - (unsigned)__builtin_clzll(high);
+    unsigned bits = (unsigned)getRandomBetween(ctx, lowBits, highBits);
+    size_t size = ((size_t)1 << bits) + (size_t)(nextRandom(ctx) & (((size_t)1 << bits) - 1));
+    return size < low ? low : size > high ? high : size;
+}
+
+static size_t clampSize(size_t value, size_t low, size_t high) {
+    return value < low ? low : value > high ? high : value;
+}
+
+//live blocks a kernel keeps for a heap of this size, if its blocks average averageSize bytes
+static size_t getLiveBlocks(const benchContext *ctx, size_t averageSize) {
+    return clampSize(ctx->heapSize / (4 * averageSize), 16, MAX_LIVE_BLOCKS);
+}
+
+/*
+Allocator interface. Every call goes through these, which count it, check the limits
+every TIME_CHECK_OPS calls, and track the footprint in the untimed run.
+*/
+
+#ifdef BENCH_GLIBC
+static void *initAllocator(void *start, void *end) {
+    (void)end;
+    return start; //glibc ignores the heap area; it only sizes the kernels
+}
+#define allocatorAlloc(heap, n)         malloc(n)
+#define allocatorFree(heap, p)          free(p)
+#define allocatorRealloc(heap, p, n)    realloc(p, n)
+#else
+#define initAllocator(start, end)       cpen212_init(start, end)
+#define allocatorAlloc(heap, n)         cpen212_alloc(heap, n)
+#define allocatorFree(heap, p)          cpen212_free(heap, p)
+#define allocatorRealloc(heap, p, n)    cpen212_realloc(heap, p, n)
+#endif
+
+static void countOp(benchContext *ctx) {
+    ctx->ops++;
+    if (ctx->stopped) {
+        return;
+    }
+    if (ctx->ops >= ctx->opLimit
+        || (ctx->deadlineNs && ctx->ops % TIME_CHECK_OPS == 0 && nowNs() >= ctx->deadlineNs)) {
+        ctx->stopped = true;
+        ctx->stoppedAt = ctx->ops;
+    }
+}
+
+static void trackFootprint(benchContext *ctx, void *p, size_t nbytes) {
+#ifdef BENCH_GLIBC
+    (void)p;
+    (void)nbytes;
+    if (ctx->ops % GLIBC_FOOTPRINT_SAMPLE_OPS == 0) {
+        struct mallinfo2 info = mallinfo2();
+        size_t footprint = info.arena + info.hblkhd;
+        ctx->peakFootprint = footprint > ctx->peakFootprint ? footprint : ctx->peakFootprint;
+    }
+#else
+    if (p) {
+        size_t footprint = (size_t)((char *)p + nbytes - ctx->heapStart);
+        ctx->peakFootprint = footprint > ctx->peakFootprint ? footprint : ctx->peakFootprint;
+    }
+#endif
+}
+
+static void *benchAlloc(benchContext *ctx, size_t nbytes) {
+    void *p = allocatorAlloc(ctx->heap, nbytes);
+    if (p) {
+        *(volatile char *)p = 1; //touch the block, as a real caller would
+    } else {
+        ctx->failed++;
+    }
+    if (ctx->trackFootprint) {
+        trackFootprint(ctx, p, nbytes);
+    }
+    countOp(ctx);
+    return p;
+}
+
+static void benchFree(benchContext *ctx, void *p) {
+    allocatorFree(ctx->heap, p);
+    countOp(ctx);
+}
+
+//realloc that keeps prev on failure, as the callers want
+static void *benchRealloc(benchContext *ctx, void *prev, size_t nbytes) {
+    void *p = allocatorRealloc(ctx->heap, prev, nbytes);
+    if (p) {
+        ((volatile char *)p)[nbytes - 1] = 1;
+    } else {
+        ctx->failed++;
+    }
+    if (ctx->trackFootprint) {
+        trackFootprint(ctx, p, nbytes);
+    }
+    countOp(ctx);
+    return p;
+}
+
+static void **getSlots(size_t count) {
+    void **slots = calloc(count, sizeof(void *));
+    if (!slots) {
+        fprintf(stderr, "cpen212bench: out of memory\n");
+        exit(2);
+    }
+    return slots;
+}
+
+static void freeSlots(benchContext *ctx, void **slots, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (slots[i]) {
+            benchFree(ctx, slots[i]);
+        }
+    }
+    free(slots);
+}
+
+/*
+Kernels. Each one loops until ctx->stopped, then frees whatever it still holds
+(those frees are counted too).
+*/
+
+static void runLifo(benchContext *ctx) {
+    size_t count = getLiveBlocks(ctx, 256);
+    void **slots = getSlots(count);
+    while (!ctx->stopped) {
+        size_t filled = 0;
+        for (; filled < count && !ctx->stopped; filled++) {
+            slots[filled] = benchAlloc(ctx, getRandomBetween(ctx, 16, 512));
+        }
+        while (filled > 0 && !ctx->stopped) {
+            filled--;
+            if (slots[filled]) {
+                benchFree(ctx, slots[filled]);
+            }
+            slots[filled] = NULL;
+        }
+    }
+    freeSlots(ctx, slots, count);
+}
+
+static void runFifo(benchContext *ctx) {
+    size_t count = getLiveBlocks(ctx, 256);
+    void **slots = getSlots(count);
+    for (size_t i = 0; i < count && !ctx->stopped; i++) {
+        slots[i] = benchAlloc(ctx, getRandomBetween(ctx, 16, 512));
+    }
+    for (size_t oldest = 0; !ctx->stopped; oldest = (oldest + 1) % count) {
+        if (slots[oldest]) {
+            benchFree(ctx, slots[oldest]);
+        }
+        slots[oldest] = benchAlloc(ctx, getRandomBetween(ctx, 16, 512));
+    }
+    freeSlots(ctx, slots, count);
+}
+
+static void runRandom(benchContext *ctx) {
+    size_t count = getLiveBlocks(ctx, 1024);
+    void **slots = getSlots(count);
+    while (!ctx->stopped) {
+        size_t i = getRandomBetween(ctx, 0, count - 1);
+        if (slots[i]) {
+            benchFree(ctx, slots[i]);
+            slots[i] = NULL;
+        } else {
+            slots[i] = benchAlloc(ctx, getRandomSize(ctx, 8, 4096));
+        }
+    }
+    freeSlots(ctx, slots, count);
+}
+
+static void runReallocChains(benchContext *ctx) {
+    size_t maxSize = clampSize(ctx->heapSize / 64, 256, (size_t)1 << 16);
+    size_t count = clampSize(ctx->heapSize / (4 * maxSize), 1, 256);
+    void **slots = getSlots(count);
+    size_t *sizes = calloc(count, sizeof(size_t));
+    if (!sizes) {
+        fprintf(stderr, "cpen212bench: out of memory\n");
+        exit(2);
+    }
+    while (!ctx->stopped) {
+        size_t i = getRandomBetween(ctx, 0, count - 1);
+        if (sizes[i] >= maxSize) {
+            benchFree(ctx, slots[i]);
+            slots[i] = NULL;
+            sizes[i] = 0;
+            continue;
+        }
+        //grow by 25-100%, starting from 16 bytes
+        size_t size = sizes[i] ? sizes[i] + sizes[i] * getRandomBetween(ctx, 1, 4) / 4 : 16;
+        size = size < maxSize ? size : maxSize;
+        void *p = benchRealloc(ctx, slots[i], size);
+        if (p) {
+            slots[i] = p;
+            sizes[i] = size;
+        } else if (slots[i]) {
+            benchFree(ctx, slots[i]); //start the chain over rather than retrying forever
+            slots[i] = NULL;
+            sizes[i] = 0;
+        }
+    }
+    free(sizes);
+    freeSlots(ctx, slots, count);
+}
+
+static void runFragmentStorm(benchContext *ctx) {
+    size_t count = clampSize(ctx->heapSize * 3 / 5 / 96, 16, MAX_LIVE_BLOCKS); //~60% of the heap in 64-byte blocks
+    size_t largeCount = 64;
+    void **slots = getSlots(count);
+    void **large = getSlots(largeCount);
+    size_t largeMax = clampSize(ctx->heapSize / 64, 256, (size_t)1 << 24);
+    while (!ctx->stopped) {
+        for (size_t i = 0; i < count && !ctx->stopped; i++) {
+            slots[i] = benchAlloc(ctx, 64);
+        }
+        for (size_t i = 0; i < count && !ctx->stopped; i += 2) {
+            if (slots[i]) {
+                benchFree(ctx, slots[i]);
+            }
+            slots[i] = NULL;
+        }
+        //every other small block is free, so large requests need the tail or coalesced space
+        for (size_t i = 0; i < largeCount && !ctx->stopped; i++) {
+            large[i] = benchAlloc(ctx, getRandomBetween(ctx, 128, largeMax));
+        }
+        for (size_t i = 0; i < largeCount && !ctx->stopped; i++) {
+            if (large[i]) {
+                benchFree(ctx, large[i]);
+            }
+            large[i] = NULL;
+        }
+        for (size_t i = 1; i < count && !ctx->stopped; i += 2) {
+            if (slots[i]) {
+                benchFree(ctx, slots[i]);
+            }
+            slots[i] = NULL;
+        }
+    }
+    freeSlots(ctx, large, largeCount);
+    freeSlots(ctx, slots, count);
+}
+
+typedef struct kernelInfo {
+    const char *name;
+    benchKernel run;
+} kernelInfo;
+
+static const kernelInfo kernels[] = {
+    {"lifo", runLifo},
+    {"fifo", runFifo},
+    {"random", runRandom},
+    {"realloc", runReallocChains},
+    {"fragment", runFragmentStorm},
+};
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+//run kernel once on a fresh heap; returns false if the heap could not be set up
+static bool runOnce(const kernelInfo *kernel, size_t heapSize, uint64_t seed, benchContext *ctx) {
+    void *start = mmap(NULL, heapSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) {
+        return false;
+    }
+    ctx->heapStart = start;
+    ctx->heapSize = heapSize;
+    ctx->rng = seed * 0x9e3779b97f4a7c15ull + 1; //never 0
+    ctx->heap = initAllocator(start, (char *)start + heapSize);
+    bool ok = ctx->heap != NULL;
+    if (ok) {
+        kernel->run(ctx);
+    }
+#ifdef BENCH_GLIBC
+    malloc_trim(0); //start the next run from a comparable state
+#endif
+    munmap(start, heapSize);
+    return ok;
+}
+
+static bool runKernel(const kernelInfo *kernel, size_t heapSize, size_t opLimit, double seconds, uint64_t seed) {
+    benchContext timed = {.opLimit = opLimit};
+    timed.deadlineNs = seconds > 0 ? nowNs() + (uint64_t)(seconds * 1e9) : 0;
+    uint64_t startNs = nowNs();
+    uint64_t startCycles = readCycles();
+    bool ok = runOnce(kernel, heapSize, seed, &timed);
+    uint64_t cycles = readCycles() - startCycles;
+    uint64_t ns = nowNs() - startNs;
+    if (!ok) {
+        fprintf(stderr, "cpen212bench: cannot set up a %zu-byte heap\n", heapSize);
+        return false;
+    }
+
+    //same calls again, untimed, to find the footprint
+    benchContext measured = {.opLimit = timed.stoppedAt, .trackFootprint = true};
+    runOnce(kernel, heapSize, seed, &measured);
+
+    printf("%s,%s,%zu,%zu,%.1f,%.1f,%zu,%zu\n", BENCH_ALLOCATOR, kernel->name, heapSize, timed.ops,
+           (double)cycles / (double)timed.ops, (double)ns / (double)timed.ops,
+           measured.peakFootprint, timed.failed);
+    fflush(stdout);
+    return true;
+}
+
+//parse a size with an optional K, M or G suffix
+static bool parseSize(const char *text, size_t *size) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 0);
+    if (errno || end == text) {
+        return false;
+    }
+    switch (*end) {
+    case 'K': case 'k': value <<= 10; end++; break;
+    case 'M': case 'm': value <<= 20; end++; break;
+    case 'G': case 'g': value <<= 30; end++; break;
+    default: break;
+    }
+    *size = (size_t)value & ~(size_t)7;
+    return *end == '\0' && *size > 0;
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr, "usage: %s [-H] [-k kernel,...] [-s size,...] [-n ops] [-t seconds] [-r seed]\n", program);
+}
+
+int main(int argc, char **argv) {
+    bool header = false;
+    const char *kernelList = NULL;
+    char defaultSizes[] = "64K,1M,64M,1G";
+    char *sizeList = defaultSizes;
+    size_t opLimit = DEFAULT_OPS;
+    double seconds = DEFAULT_SECONDS;
+    uint64_t seed = DEFAULT_SEED;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-H") == 0) {
+            header = true;
+        } else if (strcmp(argv[i], "-k") == 0 && hasValue) {
+            kernelList = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0 && hasValue) {
+            sizeList = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && hasValue) {
+            opLimit = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-t") == 0 && hasValue) {
+            seconds = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "-r") == 0 && hasValue) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (opLimit == 0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    if (header) {
+        printf("allocator,kernel,heap_bytes,ops,cycles_per_op,ns_per_op,peak_footprint_bytes,failed_allocs\n");
+    }
+
+    bool ok = true;
+    for (char *size = strtok(sizeList, ","); size && ok; size = strtok(NULL, ",")) {
+        size_t heapSize;
+        if (!parseSize(size, &heapSize)) {
+            fprintf(stderr, "cpen212bench: bad heap size %s\n", size);
+            return 2;
+        }
+        for (size_t k = 0; k < NUM_KERNELS && ok; k++) {
+            if (kernelList) {
+                //match whole names in the comma-separated list
+                size_t length = strlen(kernels[k].name);
+                const char *found = kernelList;
+                while ((found = strstr(found, kernels[k].name))
+                       && ((found != kernelList && found[-1] != ',') || (found[length] && found[length] != ','))) {
+                    found += length;
+                }
+                if (!found) {
+                    continue;
+                }
+            }
+            ok = runKernel(&kernels[k], heapSize, opLimit, seconds, seed);
+        }
+    }
+    return ok ? 0 : 1;
+}
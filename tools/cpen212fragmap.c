@@ -0,0 +1,336 @@
+// Offline analyser for the heap fragmentation maps that cpen212_debug(heap,
+// DEBUG_OP_FRAGMAP_DUMP) writes (the format is described in task5/cpen212common.h).
+//
+// It prints fragmentation metrics for the heap at the moment of the dump:
+//
+//     external fragmentation   1 - largest free block / free bytes, as in heapReport
+//     top free                 free bytes past the last allocated block, which any
+//                              request can still use
+//     free in blocks >= N      share of the free bytes that could serve a request of
+//                              about N bytes, for a few N
+//     free [a, b)              free block size histogram
+//
+// followed by an occupancy map of the heap, one character per cell of heap bytes:
+//
+//     ' ' free   '.' under 1/4 allocated   ':' under 1/2   '+' under 3/4
+//     '*' under all   '#' all allocated    '?' past where the dump stopped
+//
+// Slab pages count as allocated. The same map can also be written as an SVG image.
+//
+// usage: cpen212fragmap [-w columns] [-r rows] [-n] [-s svg_file] [map_file]
+//   -w columns  map cells per row (default: 64)
+//   -r rows     map rows (default: 16)
+//   -n          leave out the ASCII map
+//   -s file     also write the map as SVG to file
+//   map_file    the dump to read (default: stdin)
+//
+// For example, to look at a heap when an allocation fails:
+//
+//     int fd = open("heap.map", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+//     cpen212_debug_query(heap, DEBUG_OP_FRAGMAP_DUMP, &fd);
+//
+// and then "cpen212fragmap -s heap.svg heap.map". Build it with "make cpen212fragmap"
+// in this directory.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpen212common.h"
+
+#define DEFAULT_COLUMNS 64
+#define DEFAULT_ROWS    16
+#define MAX_CELLS       ((size_t)1 << 24)
+#define SVG_CELL_PIXELS 8
+#define SVG_SHADES      16
+
+static const size_t requestSizes[] = {64, 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024};
+#define NUM_REQUEST_SIZES (sizeof(requestSizes) / sizeof(requestSizes[0]))
+
+typedef struct fragmap {
+    uint64_t heapSize, firstBlock, reached;
+    uint64_t allocatedBlocks, allocatedBytes, slabPages;
+    uint64_t freeBlocks, freeBytes, largestFree;
+    uint64_t lastAllocatedEnd;  // offset just past the last allocated block
+    uint64_t freeAtLeast[NUM_REQUEST_SIZES]; // free bytes in blocks of at least requestSizes[i]
+    uint64_t freeBuckets[NUM_FREE_BUCKETS];
+    size_t numCells;
+    uint64_t cellBytes;         // heap bytes per map cell (the last cell may cover fewer)
+    uint64_t *cellAllocated;    // allocated bytes in each cell
+} fragmap;
+
+//read one unsigned LEB128 varint; false at the end of the input or on a bad encoding
+static bool readVarint(FILE *in, uint64_t *value) {
+    *value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = getc(in);
+        if (c == EOF) {
+            return false;
+        }
+        *value |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//add the allocated bytes of [start, end) to the cells it covers
+static void markAllocated(fragmap *map, uint64_t start, uint64_t end) {
+    start -= map->firstBlock;
+    end -= map->firstBlock;
+    for (size_t cell = start / map->cellBytes; start < end; cell++) {
+        uint64_t cellEnd = (cell + 1) * map->cellBytes;
+        uint64_t stop = end < cellEnd ? end : cellEnd;
+        map->cellAllocated[cell] += stop - start;
+        start = stop;
+    }
+}
+
+static void addFreeBlocks(fragmap *map, uint64_t size, uint64_t count) {
+    map->freeBlocks += count;
+    map->freeBytes += size * count;
+    if (size > map->largestFree) {
+        map->largestFree = size;
+    }
+    for (size_t i = 0; i < NUM_REQUEST_SIZES; i++) {
+        if (size >= requestSizes[i]) {
+            map->freeAtLeast[i] += size * count;
+        }
+    }
+    map->freeBuckets[63 - __builtin_clzll(size)] += count;
+}
+
+static bool readFragmap(FILE *in, fragmap *map, size_t numCells) {
+    char magic[FRAGMAP_MAGIC_SIZE];
+    uint64_t version;
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, FRAGMAP_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "cpen212fragmap: not a fragmentation map\n");
+        return false;
+    }
+    if (!readVarint(in, &version) || !readVarint(in, &map->heapSize) || !readVarint(in, &map->firstBlock)) {
+        fprintf(stderr, "cpen212fragmap: truncated map header\n");
+        return false;
+    }
+    if (version != FRAGMAP_VERSION) {
+        fprintf(stderr, "cpen212fragmap: map version %llu is not supported\n", (unsigned long long)version);
+        return false;
+    }
+    if (map->firstBlock >= map->heapSize) {
+        fprintf(stderr, "cpen212fragmap: the heap has no blocks\n");
+        return false;
+    }
+
+    uint64_t span = map->heapSize - map->firstBlock;
+    map->numCells = span < numCells ? (size_t)span : numCells;
+    map->cellBytes = (span + map->numCells - 1) / map->numCells;
+    map->cellAllocated = calloc(map->numCells, sizeof(uint64_t));
+    if (!map->cellAllocated) {
+        fprintf(stderr, "cpen212fragmap: out of memory\n");
+        return false;
+    }
+
+    uint64_t offset = map->firstBlock;
+    for (;;) {
+        uint64_t word, count;
+        if (!readVarint(in, &word) || !readVarint(in, &count)) {
+            fprintf(stderr, "cpen212fragmap: truncated map\n");
+            return false;
+        }
+        if (word == 0) {
+            map->reached = count; //the trailer: where the walk got to
+            break;
+        }
+        uint64_t size = word & ~FRAGMAP_FLAGS_MASK;
+        if (size == 0 || count == 0 || count > (map->heapSize - offset) / size) {
+            fprintf(stderr, "cpen212fragmap: run at offset %llu goes past the heap end\n", (unsigned long long)offset);
+            return false;
+        }
+        uint64_t end = offset + size * count;
+        if (word & FRAGMAP_ALLOCATED) {
+            map->allocatedBlocks += count;
+            map->allocatedBytes += size * count;
+            map->slabPages += (word & FRAGMAP_SLAB) ? count : 0;
+            map->lastAllocatedEnd = end;
+            markAllocated(map, offset, end);
+        } else {
+            addFreeBlocks(map, size, count);
+        }
+        offset = end;
+    }
+    if (map->reached != offset) {
+        fprintf(stderr, "cpen212fragmap: map trailer does not match its runs\n");
+        return false;
+    }
+    return true;
+}
+
+static void printMetrics(const fragmap *map) {
+    printf("heap: %llu bytes, %llu blocks", (unsigned long long)map->heapSize,
+           (unsigned long long)(map->allocatedBlocks + map->freeBlocks));
+    if (map->reached < map->heapSize) {
+        printf(" (the dump stopped at a broken block at offset %llu)", (unsigned long long)map->reached);
+    }
+    printf("\n");
+    printf("allocated: %llu bytes in %llu blocks, %llu of them slab pages\n",
+           (unsigned long long)map->allocatedBytes, (unsigned long long)map->allocatedBlocks,
+           (unsigned long long)map->slabPages);
+    printf("free: %llu bytes in %llu blocks, largest %llu, mean %.1f\n",
+           (unsigned long long)map->freeBytes, (unsigned long long)map->freeBlocks,
+           (unsigned long long)map->largestFree,
+           map->freeBlocks ? (double)map->freeBytes / (double)map->freeBlocks : 0.0);
+    printf("external fragmentation: %.4f\n",
+           map->freeBytes ? 1.0 - (double)map->largestFree / (double)map->freeBytes : 0.0);
+    uint64_t top = map->lastAllocatedEnd ? map->reached - map->lastAllocatedEnd : map->reached - map->firstBlock;
+    printf("top free: %llu bytes past the last allocated block\n", (unsigned long long)top);
+    for (size_t i = 0; i < NUM_REQUEST_SIZES; i++) {
+        printf("free in blocks >= %zu: %.2f%%\n", requestSizes[i],
+               map->freeBytes ? 100.0 * (double)map->freeAtLeast[i] / (double)map->freeBytes : 0.0);
+    }
+    for (size_t i = 0; i < NUM_FREE_BUCKETS; i++) {
+        if (map->freeBuckets[i]) {
+            printf("free [%zu, %zu): %llu\n", (size_t)1 << i, (size_t)2 << i, (unsigned long long)map->freeBuckets[i]);
+        }
+    }
+}
+
+//bytes of the heap in a cell (the last one may be short), and whether the dump got that far
+static uint64_t getCellBytes(const fragmap *map, size_t cell, bool *known) {
+    uint64_t start = map->firstBlock + cell * map->cellBytes;
+    uint64_t end = start + map->cellBytes < map->heapSize ? start + map->cellBytes : map->heapSize;
+    *known = end <= map->reached;
+    return end - start;
+}
+
+//share of a cell that is allocated, from 0 to 1, or -1 if the dump stopped before it
+static double getCellShare(const fragmap *map, size_t cell) {
+    bool known;
+    uint64_t bytes = getCellBytes(map, cell, &known);
+    return known ? (double)map->cellAllocated[cell] / (double)bytes : -1.0;
+}
+
+static char getCellChar(double share) {
+    if (share < 0) {
+        return '?';
+    }
+    if (share == 0) {
+        return ' ';
+    }
+    if (share >= 1) {
+        return '#';
+    }
+    return ".:+*"[(int)(share * 4)];
+}
+
+static void printAsciiMap(const fragmap *map, size_t columns) {
+    printf("\neach cell is %llu bytes; '#' allocated, ' ' free\n", (unsigned long long)map->cellBytes);
+    for (size_t row = 0; row * columns < map->numCells; row++) {
+        printf("%12llu |", (unsigned long long)(map->firstBlock + row * columns * map->cellBytes));
+        for (size_t cell = row * columns; cell < map->numCells && cell < (row + 1) * columns; cell++) {
+            putchar(getCellChar(getCellShare(map, cell)));
+        }
+        printf("|\n");
+    }
+}
+
+static void getSvgColour(int shade, char *colour) {
+    if (shade < 0) {
+        strcpy(colour, "#e04040");
+        return;
+    }
+    int level = 0xe8 - (0xe8 - 0x30) * shade / SVG_SHADES; //light grey when free, dark when allocated
+    sprintf(colour, "#%02x%02x%02x", level, level, level);
+}
+
+//one rect per run of cells with the same shade along a row
+static bool writeSvgMap(const fragmap *map, size_t columns, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return false;
+    }
+    size_t rows = (map->numCells + columns - 1) / columns;
+    fprintf(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%zu\" height=\"%zu\">\n",
+            columns * SVG_CELL_PIXELS, rows * SVG_CELL_PIXELS);
+    fprintf(out, "<title>heap of %llu bytes, %llu bytes per cell, external fragmentation %.4f</title>\n",
+            (unsigned long long)map->heapSize, (unsigned long long)map->cellBytes,
+            map->freeBytes ? 1.0 - (double)map->largestFree / (double)map->freeBytes : 0.0);
+    for (size_t row = 0; row < rows; row++) {
+        size_t first = row * columns;
+        size_t last = first + columns < map->numCells ? first + columns : map->numCells;
+        for (size_t cell = first; cell < last;) {
+            double share = getCellShare(map, cell);
+            int shade = share < 0 ? -1 : (int)(share * SVG_SHADES + 0.5);
+            size_t runEnd = cell + 1;
+            while (runEnd < last) {
+                double next = getCellShare(map, runEnd);
+                if ((next < 0 ? -1 : (int)(next * SVG_SHADES + 0.5)) != shade) {
+                    break;
+                }
+                runEnd++;
+            }
+            char colour[8];
+            getSvgColour(shade, colour);
+            fprintf(out, "<rect x=\"%zu\" y=\"%zu\" width=\"%zu\" height=\"%d\" fill=\"%s\"/>\n",
+                    (cell - first) * SVG_CELL_PIXELS, row * SVG_CELL_PIXELS,
+                    (runEnd - cell) * SVG_CELL_PIXELS, SVG_CELL_PIXELS, colour);
+            cell = runEnd;
+        }
+    }
+    fprintf(out, "</svg>\n");
+    return fclose(out) == 0;
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr, "usage: %s [-w columns] [-r rows] [-n] [-s svg_file] [map_file]\n", program);
+}
+
+int main(int argc, char **argv) {
+    size_t columns = DEFAULT_COLUMNS, rows = DEFAULT_ROWS;
+    bool ascii = true;
+    const char *svgPath = NULL, *mapPath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-w") == 0 && hasValue) {
+            columns = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-r") == 0 && hasValue) {
+            rows = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            ascii = false;
+        } else if (strcmp(argv[i], "-s") == 0 && hasValue) {
+            svgPath = argv[++i];
+        } else if (argv[i][0] != '-' && !mapPath) {
+            mapPath = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (columns == 0 || rows == 0 || rows > MAX_CELLS / columns) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    FILE *in = mapPath ? fopen(mapPath, "rb") : stdin;
+    if (!in) {
+        perror(mapPath);
+        return 1;
+    }
+    fragmap map;
+    memset(&map, 0, sizeof(map));
+    bool ok = readFragmap(in, &map, columns * rows);
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (ok) {
+        printMetrics(&map);
+        if (ascii) {
+            printAsciiMap(&map, columns);
+        }
+        ok = !svgPath || writeSvgMap(&map, columns, svgPath);
+    }
+    free(map.cellAllocated);
+    return ok ? 0 : 1;
+}
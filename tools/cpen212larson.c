@@ -0,0 +1,623 @@
+// Multithreaded scalability benchmark (Larson / xmalloc style) for the task5 allocator.
+//
+// Workloads, each running a fixed number of calls per thread:
+//
+//     larson    every thread replaces random blocks in its own array of slots; after
+//               each round the arrays move on to the next thread, so most frees are of
+//               blocks another thread allocated (Larson's server simulation)
+//     pingpong  threads pair up as producer and consumer: one allocates blocks and
+//               passes them through a queue, the other frees them (xmalloc style);
+//               it needs at least 2 threads, and is skipped for a thread count of 1
+//     private   like larson, but the arrays never move, so no block crosses threads
+//
+// Heap-sharing configurations:
+//
+//     locked    one cpen212 heap behind one mutex
+//     mt        one heap shared through the cpen212mt layer (thread caches, lock-free remote frees)
+//     private   one cpen212 heap and mutex per thread; a block is freed into the heap it came from
+//     glibc     glibc malloc, for reference
+//
+// Output is one CSV line per configuration, workload and thread count:
+//
+//     config,workload,threads,ops,seconds,mops_per_sec,speedup,lock_wait_ms,contended_pct,
+//     peak_footprint_bytes,peak_live_bytes,blowup
+//
+// seconds runs from the first thread starting its calls to the last one finishing, and
+// speedup is against the first thread count run for the same configuration and workload.
+// lock_wait_ms is the total time threads spent blocked on heap locks, and contended_pct
+// the share of acquisitions that had to wait; the mt layer only counts these when built
+// with -DCPEN212_STATS, as the Makefile does. The footprint of a cpen212 heap is how far
+// into it any block reached (for glibc, mallinfo2's arena and mmapped bytes at the end of
+// the run), and blowup is peak footprint over peak live requested bytes.
+//
+// usage: cpen212larson [-H] [-c config,...] [-w workload,...] [-t threads,...] [-n ops]
+//                      [-S slots] [-m heap_bytes] [-r seed]
+//   -H          print the CSV header line first
+//   -c configs  configurations to run (default: all)
+//   -w loads    workloads to run (default: all)
+//   -t threads  thread counts (default: 1, 2, 4, ... up to the number of CPUs)
+//   -n ops      calls per thread (default: 1000000)
+//   -S slots    blocks each thread keeps live (default: 1000)
+//   -m bytes    total heap size, split evenly for private heaps (default: 1 GiB)
+//   -r seed     random seed (default: 212)
+//
+// Build it with "make cpen212larson" in this directory.
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "cpen212alloc.h"
+#include "cpen212mt.h"
+
+#define DEFAULT_OPS       1000000
+#define DEFAULT_SLOTS     1000
+#define DEFAULT_HEAP_SIZE ((size_t)1 << 30)
+#define DEFAULT_SEED      212
+#define MIN_BLOCK_BYTES   16
+#define MAX_BLOCK_BYTES   512
+#define ROUND_OPS         10000 // larson calls between handoffs
+#define QUEUE_SIZE        1024  // pingpong queue entries (a power of two)
+#define LIVE_SAMPLE_OPS   1024  // calls between samples of the total live bytes
+#define MAX_THREADS       256
+#define CACHE_LINE        64
+
+typedef enum heapConfig {
+    CONFIG_LOCKED,
+    CONFIG_MT,
+    CONFIG_PRIVATE,
+    CONFIG_GLIBC,
+    NUM_CONFIGS,
+} heapConfig;
+
+typedef enum workload {
+    WORKLOAD_LARSON,
+    WORKLOAD_PINGPONG,
+    WORKLOAD_PRIVATE,
+    NUM_WORKLOADS,
+} workload;
+
+static const char *configNames[NUM_CONFIGS] = {"locked", "mt", "private", "glibc"};
+static const char *workloadNames[NUM_WORKLOADS] = {"larson", "pingpong", "private"};
+
+typedef struct liveBlock {
+    void *p;
+    size_t size;
+} liveBlock;
+
+//a cpen212 heap with the mutex that guards it
+typedef struct lockedHeap {
+    pthread_mutex_t lock;
+    void *heap;
+    uint64_t waitNs, acquisitions, contended; // written by the lock holder
+} __attribute__((aligned(CACHE_LINE))) lockedHeap;
+
+//single-producer single-consumer queue of blocks
+typedef struct blockQueue {
+    uint64_t head __attribute__((aligned(CACHE_LINE)));  // next entry to pop (consumer only)
+    uint64_t tail __attribute__((aligned(CACHE_LINE)));  // next entry to push (producer only)
+    liveBlock entries[QUEUE_SIZE] __attribute__((aligned(CACHE_LINE)));
+} blockQueue;
+
+struct benchRun;
+
+typedef struct worker {
+    struct benchRun *run;
+    size_t index;
+    pthread_t thread;
+    uint64_t rng;
+    int64_t liveBytes;      // bytes this thread allocated minus bytes it freed (read by others)
+    size_t peakLive;        // largest total live bytes this thread saw when sampling
+    size_t peakEnd;         // furthest any block this thread allocated reached into its heap
+    uint64_t startNs, endNs; // when this thread started and finished its calls
+} __attribute__((aligned(CACHE_LINE))) worker;
+
+typedef struct benchRun {
+    heapConfig config;
+    workload load;
+    size_t numThreads, ops, slots;
+    char *memory;           // the heap area (cpen212 configurations)
+    size_t memoryBytes, heapBytes; // whole area, and each heap's share of it
+    lockedHeap *heaps;      // 1 (locked) or numThreads (private)
+    mtHeap *mt;
+    worker *workers;
+    liveBlock **arrays;     // slot arrays (larson, private)
+    blockQueue *queues;     // one per producer/consumer pair (pingpong)
+    pthread_barrier_t barrier;
+} benchRun;
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+//xorshift64*
+static uint64_t nextRandom(worker *w) {
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return w->rng * 0x2545f4914f6cdd1dull;
+}
+
+static size_t getRandomSize(worker *w) {
+    return MIN_BLOCK_BYTES + (size_t)(nextRandom(w) % (MAX_BLOCK_BYTES - MIN_BLOCK_BYTES + 1));
+}
+
+static void *checkedCalloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (!p) {
+        fprintf(stderr, "cpen212larson: out of memory\n");
+        exit(2);
+    }
+    return p;
+}
+
+/*
+Allocation through the configuration under test. The benchmark's own bookkeeping
+(slot arrays, queues, worker records) always comes from glibc, outside the timed heap.
+*/
+
+static void lockHeap(lockedHeap *heap) {
+    if (pthread_mutex_trylock(&heap->lock) != 0) {
+        uint64_t start = nowNs();
+        pthread_mutex_lock(&heap->lock);
+        heap->waitNs += nowNs() - start;
+        heap->contended++;
+    }
+    heap->acquisitions++;
+}
+
+//heap that p came from (private configuration)
+static lockedHeap *getOwnerHeap(benchRun *run, void *p) {
+    return &run->heaps[(size_t)((char *)p - run->memory) / run->heapBytes];
+}
+
+static void *benchAlloc(worker *w, size_t nbytes) {
+    benchRun *run = w->run;
+    void *p;
+    switch (run->config) {
+    case CONFIG_LOCKED:
+    case CONFIG_PRIVATE: {
+        lockedHeap *heap = &run->heaps[run->config == CONFIG_LOCKED ? 0 : w->index];
+        lockHeap(heap);
+        p = cpen212_alloc(heap->heap, nbytes);
+        pthread_mutex_unlock(&heap->lock);
+        break;
+    }
+    case CONFIG_MT:
+        p = cpen212_mt_alloc(run->mt, nbytes);
+        break;
+    case CONFIG_GLIBC:
+    default:
+        p = malloc(nbytes);
+        break;
+    }
+
+    if (p) {
+        *(volatile char *)p = 1; //touch the block, as a real caller would
+        __atomic_store_n(&w->liveBytes, w->liveBytes + (int64_t)nbytes, __ATOMIC_RELAXED);
+        if (run->config != CONFIG_GLIBC) {
+            size_t heapStart = run->config == CONFIG_PRIVATE ? w->index * run->heapBytes : 0;
+            size_t end = (size_t)((char *)p - run->memory) + nbytes - heapStart;
+            w->peakEnd = end > w->peakEnd ? end : w->peakEnd;
+        }
+    }
+    return p;
+}
+
+static void benchFree(worker *w, void *p, size_t nbytes) {
+    benchRun *run = w->run;
+    if (!p) {
+        return;
+    }
+    switch (run->config) {
+    case CONFIG_LOCKED:
+    case CONFIG_PRIVATE: {
+        lockedHeap *heap = run->config == CONFIG_LOCKED ? &run->heaps[0] : getOwnerHeap(run, p);
+        lockHeap(heap);
+        cpen212_free(heap->heap, p);
+        pthread_mutex_unlock(&heap->lock);
+        break;
+    }
+    case CONFIG_MT:
+        cpen212_mt_free(run->mt, p);
+        break;
+    case CONFIG_GLIBC:
+    default:
+        free(p);
+        break;
+    }
+    __atomic_store_n(&w->liveBytes, w->liveBytes - (int64_t)nbytes, __ATOMIC_RELAXED);
+}
+
+//every LIVE_SAMPLE_OPS calls, add up every thread's live bytes and keep the peak
+static void sampleLive(worker *w, size_t op) {
+    if (op % LIVE_SAMPLE_OPS != 0) {
+        return;
+    }
+    int64_t total = 0;
+    for (size_t i = 0; i < w->run->numThreads; i++) {
+        total += __atomic_load_n(&w->run->workers[i].liveBytes, __ATOMIC_RELAXED);
+    }
+    if (total > 0 && (size_t)total > w->peakLive) {
+        w->peakLive = (size_t)total;
+    }
+}
+
+/*
+Workloads. Every thread makes run->ops calls; a replacement counts as two.
+*/
+
+static void replaceSlots(worker *w, liveBlock *slots, size_t *done, size_t limit) {
+    while (*done < limit) {
+        liveBlock *slot = &slots[nextRandom(w) % w->run->slots];
+        if (slot->p) {
+            benchFree(w, slot->p, slot->size);
+            (*done)++;
+        }
+        slot->size = getRandomSize(w);
+        slot->p = benchAlloc(w, slot->size);
+        (*done)++;
+        sampleLive(w, *done);
+    }
+}
+
+static size_t getNumRounds(const benchRun *run) {
+    return (run->ops + ROUND_OPS - 1) / ROUND_OPS;
+}
+
+static void runSlots(worker *w, bool handOff) {
+    benchRun *run = w->run;
+    size_t done = 0;
+    for (size_t round = 0; round < getNumRounds(run); round++) {
+        //round r: thread t works on array (t + r) mod n; the barrier keeps arrays from being shared
+        size_t array = handOff ? (w->index + round) % run->numThreads : w->index;
+        size_t limit = (round + 1) * ROUND_OPS < run->ops ? (round + 1) * ROUND_OPS : run->ops;
+        replaceSlots(w, run->arrays[array], &done, limit);
+        if (handOff) {
+            pthread_barrier_wait(&run->barrier);
+        }
+    }
+}
+
+static void pushBlock(blockQueue *queue, liveBlock block) {
+    uint64_t tail = queue->tail;
+    while (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == QUEUE_SIZE) {
+        sched_yield(); //full
+    }
+    queue->entries[tail & (QUEUE_SIZE - 1)] = block;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static bool popBlock(blockQueue *queue, liveBlock *block) {
+    uint64_t head = queue->head;
+    if (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *block = queue->entries[head & (QUEUE_SIZE - 1)];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void runPingPong(worker *w) {
+    benchRun *run = w->run;
+    blockQueue *queue = &run->queues[w->index / 2];
+    bool producer = w->index % 2 == 0;
+    bool alone = producer && w->index + 1 == run->numThreads; //an odd thread out frees its own blocks
+
+    for (size_t done = 0; done < run->ops;) {
+        liveBlock block;
+        if (producer) {
+            block.size = getRandomSize(w);
+            block.p = benchAlloc(w, block.size);
+            pushBlock(queue, block);
+            done++;
+            if (alone && popBlock(queue, &block)) {
+                benchFree(w, block.p, block.size);
+                done++;
+            }
+        } else if (popBlock(queue, &block)) {
+            benchFree(w, block.p, block.size);
+            done++;
+        } else {
+            sched_yield(); //empty
+        }
+        sampleLive(w, done);
+    }
+}
+
+static void *runWorker(void *arg) {
+    worker *w = (worker *)arg;
+    pthread_barrier_wait(&w->run->barrier);
+    w->startNs = nowNs();
+    switch (w->run->load) {
+    case WORKLOAD_LARSON:
+        runSlots(w, true);
+        break;
+    case WORKLOAD_PINGPONG:
+        runPingPong(w);
+        break;
+    case WORKLOAD_PRIVATE:
+    default:
+        runSlots(w, false);
+        break;
+    }
+    if (w->run->config == CONFIG_MT) {
+        cpen212_mt_flush(w->run->mt);
+    }
+    w->endNs = nowNs();
+    pthread_barrier_wait(&w->run->barrier);
+    return NULL;
+}
+
+/*
+Runs.
+*/
+
+typedef struct runResult {
+    uint64_t ops;
+    double seconds;
+    uint64_t lockWaitNs, acquisitions, contended;
+    size_t peakFootprint, peakLive;
+} runResult;
+
+static bool setUpHeaps(benchRun *run, size_t heapSize) {
+    if (run->config == CONFIG_GLIBC) {
+        return true;
+    }
+    size_t numHeaps = run->config == CONFIG_PRIVATE ? run->numThreads : 1;
+    run->heapBytes = (heapSize / numHeaps) & ~(size_t)4095;
+    run->memoryBytes = run->heapBytes * numHeaps;
+    run->memory = mmap(NULL, run->memoryBytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (run->memory == MAP_FAILED) {
+        return false;
+    }
+
+    if (run->config == CONFIG_MT) {
+        run->mt = cpen212_mt_init(run->memory, run->memory + run->memoryBytes);
+        return run->mt != NULL;
+    }
+    run->heaps = checkedCalloc(numHeaps, sizeof(lockedHeap));
+    for (size_t i = 0; i < numHeaps; i++) {
+        char *start = run->memory + i * run->heapBytes;
+        pthread_mutex_init(&run->heaps[i].lock, NULL);
+        run->heaps[i].heap = cpen212_init(start, start + run->heapBytes);
+        if (!run->heaps[i].heap) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void tearDownHeaps(benchRun *run) {
+    if (run->config == CONFIG_GLIBC) {
+        malloc_trim(0); //start the next run from a comparable state
+        return;
+    }
+    if (run->mt) {
+        cpen212_mt_destroy(run->mt);
+    }
+    if (run->heaps) {
+        size_t numHeaps = run->config == CONFIG_PRIVATE ? run->numThreads : 1;
+        for (size_t i = 0; i < numHeaps; i++) {
+            pthread_mutex_destroy(&run->heaps[i].lock);
+        }
+        free(run->heaps);
+    }
+    munmap(run->memory, run->memoryBytes);
+}
+
+static bool runBenchmark(heapConfig config, workload load, size_t numThreads, size_t ops, size_t slots,
+                         size_t heapSize, uint64_t seed, runResult *result) {
+    benchRun run = {.config = config, .load = load, .numThreads = numThreads, .ops = ops, .slots = slots};
+    if (!setUpHeaps(&run, heapSize)) {
+        fprintf(stderr, "cpen212larson: cannot set up %s heaps\n", configNames[config]);
+        return false;
+    }
+
+    run.workers = checkedCalloc(numThreads, sizeof(worker));
+    run.arrays = checkedCalloc(numThreads, sizeof(liveBlock *));
+    run.queues = checkedCalloc((numThreads + 1) / 2, sizeof(blockQueue));
+    for (size_t i = 0; i < numThreads; i++) {
+        run.arrays[i] = checkedCalloc(slots, sizeof(liveBlock));
+        run.workers[i] = (worker){.run = &run, .index = i, .rng = (seed + i) * 0x9e3779b97f4a7c15ull + 1};
+    }
+    pthread_barrier_init(&run.barrier, NULL, (unsigned)numThreads + 1);
+
+    size_t started = 0;
+    for (; started < numThreads; started++) {
+        if (pthread_create(&run.workers[started].thread, NULL, runWorker, &run.workers[started]) != 0) {
+            break;
+        }
+    }
+    if (started < numThreads) {
+        fprintf(stderr, "cpen212larson: cannot start %zu threads\n", numThreads);
+        exit(2); //the started threads are stuck at the barrier
+    }
+
+    //larson handoffs use the barrier between rounds, so the main thread joins those waits too
+    pthread_barrier_wait(&run.barrier);
+    if (load == WORKLOAD_LARSON) {
+        for (size_t round = 0; round < getNumRounds(&run); round++) {
+            pthread_barrier_wait(&run.barrier);
+        }
+    }
+    pthread_barrier_wait(&run.barrier);
+    for (size_t i = 0; i < numThreads; i++) {
+        pthread_join(run.workers[i].thread, NULL);
+    }
+
+    //time the run by the workers' own clocks, from the first start to the last finish, since
+    //the main thread may not be scheduled until well after the workers are released
+    uint64_t start = UINT64_MAX, end = 0;
+    for (size_t i = 0; i < numThreads; i++) {
+        start = run.workers[i].startNs < start ? run.workers[i].startNs : start;
+        end = run.workers[i].endNs > end ? run.workers[i].endNs : end;
+    }
+    *result = (runResult){.ops = (uint64_t)ops * numThreads, .seconds = (double)(end - start) / 1e9};
+    for (size_t i = 0; i < numThreads; i++) {
+        worker *w = &run.workers[i];
+        result->peakLive = w->peakLive > result->peakLive ? w->peakLive : result->peakLive;
+        if (config == CONFIG_PRIVATE) {
+            result->peakFootprint += w->peakEnd;
+        } else if (w->peakEnd > result->peakFootprint) {
+            result->peakFootprint = w->peakEnd;
+        }
+    }
+    if (config == CONFIG_GLIBC) {
+        struct mallinfo2 info = mallinfo2();
+        result->peakFootprint = info.arena + info.hblkhd;
+    } else if (config == CONFIG_MT) {
+        cpen212_mt_lock_stats(run.mt, &result->lockWaitNs, &result->acquisitions, &result->contended);
+    } else {
+        for (size_t i = 0; i < (config == CONFIG_PRIVATE ? numThreads : 1); i++) {
+            result->lockWaitNs += run.heaps[i].waitNs;
+            result->acquisitions += run.heaps[i].acquisitions;
+            result->contended += run.heaps[i].contended;
+        }
+    }
+
+    //free what is still live from the main thread; the worker records stay valid after their threads
+    worker *cleaner = &run.workers[0];
+    for (size_t i = 0; i < numThreads; i++) {
+        for (size_t j = 0; j < slots; j++) {
+            benchFree(cleaner, run.arrays[i][j].p, run.arrays[i][j].size);
+        }
+        free(run.arrays[i]);
+    }
+    for (size_t i = 0; i < (numThreads + 1) / 2; i++) {
+        liveBlock block;
+        while (popBlock(&run.queues[i], &block)) {
+            benchFree(cleaner, block.p, block.size);
+        }
+    }
+    pthread_barrier_destroy(&run.barrier);
+    free(run.arrays);
+    free(run.queues);
+    free(run.workers);
+    tearDownHeaps(&run);
+    return true;
+}
+
+//true if name is one of the comma-separated names in list (or list is NULL)
+static bool isListed(const char *list, const char *name) {
+    if (!list) {
+        return true;
+    }
+    size_t length = strlen(name);
+    for (const char *item = list; item; item = strchr(item, ',') ? strchr(item, ',') + 1 : NULL) {
+        if (strncmp(item, name, length) == 0 && (item[length] == ',' || item[length] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr, "usage: %s [-H] [-c config,...] [-w workload,...] [-t threads,...] [-n ops]\n"
+                    "       [-S slots] [-m heap_bytes] [-r seed]\n", program);
+}
+
+int main(int argc, char **argv) {
+    bool header = false;
+    const char *configList = NULL, *workloadList = NULL;
+    char *threadList = NULL;
+    size_t ops = DEFAULT_OPS, slots = DEFAULT_SLOTS, heapSize = DEFAULT_HEAP_SIZE;
+    uint64_t seed = DEFAULT_SEED;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-H") == 0) {
+            header = true;
+        } else if (strcmp(argv[i], "-c") == 0 && hasValue) {
+            configList = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && hasValue) {
+            workloadList = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && hasValue) {
+            threadList = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && hasValue) {
+            ops = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-S") == 0 && hasValue) {
+            slots = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-m") == 0 && hasValue) {
+            heapSize = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-r") == 0 && hasValue) {
+            seed = strtoull(argv[++i], NULL, 0);
+        } else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (ops == 0 || slots == 0 || heapSize == 0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    size_t threadCounts[MAX_THREADS];
+    size_t numCounts = 0;
+    if (threadList) {
+        for (char *item = strtok(threadList, ","); item && numCounts < MAX_THREADS; item = strtok(NULL, ",")) {
+            size_t count = strtoull(item, NULL, 0);
+            if (count == 0 || count > MAX_THREADS) {
+                fprintf(stderr, "cpen212larson: bad thread count %s\n", item);
+                return 2;
+            }
+            threadCounts[numCounts++] = count;
+        }
+    } else {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t maxThreads = cpus > 0 && cpus < MAX_THREADS ? (size_t)cpus : MAX_THREADS;
+        for (size_t count = 1; count < maxThreads; count *= 2) {
+            threadCounts[numCounts++] = count;
+        }
+        threadCounts[numCounts++] = maxThreads;
+    }
+
+    if (header) {
+        printf("config,workload,threads,ops,seconds,mops_per_sec,speedup,lock_wait_ms,contended_pct,"
+               "peak_footprint_bytes,peak_live_bytes,blowup\n");
+    }
+    for (int config = 0; config < NUM_CONFIGS; config++) {
+        if (!isListed(configList, configNames[config])) {
+            continue;
+        }
+        for (int load = 0; load < NUM_WORKLOADS; load++) {
+            if (!isListed(workloadList, workloadNames[load])) {
+                continue;
+            }
+            double baseline = 0;
+            for (size_t i = 0; i < numCounts; i++) {
+                runResult result;
+                if (load == WORKLOAD_PINGPONG && threadCounts[i] < 2) {
+                    fprintf(stderr, "cpen212larson: skipping pingpong with 1 thread (it needs a producer and a consumer)\n");
+                    continue;
+                }
+                if (!runBenchmark((heapConfig)config, (workload)load, threadCounts[i], ops, slots,
+                                  heapSize, seed, &result)) {
+                    return 1;
+                }
+                double mops = (double)result.ops / result.seconds / 1e6;
+                baseline = baseline ? baseline : mops;
+                printf("%s,%s,%zu,%llu,%.3f,%.2f,%.2f,%.1f,%.1f,%zu,%zu,%.2f\n",
+                       configNames[config], workloadNames[load], threadCounts[i],
+                       (unsigned long long)result.ops, result.seconds, mops, mops / baseline,
+                       (double)result.lockWaitNs / 1e6,
+                       result.acquisitions ? 100.0 * (double)result.contended / (double)result.acquisitions : 0.0,
+                       result.peakFootprint, result.peakLive,
+                       result.peakLive ? (double)result.peakFootprint / (double)result.peakLive : 0.0);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,446 @@
+// LD_PRELOAD malloc shim that serves every allocation from one large cpen212 heap.
+//
+//     LD_PRELOAD=./libcpen212preload.so ./program
+//
+// Environment:
+//   CPEN212_HEAP_SIZE  heap size in bytes (default 8 GiB); the heap is mapped with
+//                      MAP_NORESERVE, so only the pages it actually touches are committed
+//   CPEN212_POLICY     placement policy number, as for cpen212_init_policy (default 0)
+//   CPEN212_TRACE      if set, record every call into capture files named
+//                      <CPEN212_TRACE>.<pid>.<tid>; turn them into a replayable trace with
+//                      cpen212replay -o trace.bin <CPEN212_TRACE>.<pid>.*
+//
+// The cpen212 heap is not thread-safe, so every call into it holds one process-wide
+// lock; the numbers are for the allocator behind a lock, not for a concurrent design.
+// Calls are recorded into a buffer per thread, outside the lock, and a buffer is only
+// written out when it fills up or its thread exits. Each event gets its sequence number
+// inside the lock, which is what lets the per-thread files be merged back into order.
+// calloc and the aligned allocation calls are recorded as plain allocations.
+//
+// malloc must return memory aligned for any type (16 bytes on x86-64), while a cpen212
+// payload is only 8-byte aligned, so by default every allocation goes through
+// cpen212_memalign. Build with -DPRELOAD_MIN_ALIGNMENT=8 to measure the allocator's own
+// path instead, for programs that do not depend on the stronger alignment.
+//
+// Pointers outside the heap (handed out by the dynamic loader before the shim was in
+// place) are ignored by free and cannot be reallocated.
+//
+// Build it with "make libcpen212preload.so" in task5.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "cpen212alloc.h"
+#include "cpen212common.h"
+#include "cpen212trace.h"
+
+#define PRELOAD_DEFAULT_HEAP_SIZE ((size_t)8 << 30)
+#ifndef PRELOAD_MIN_ALIGNMENT
+#define PRELOAD_MIN_ALIGNMENT 16
+#endif
+#define CAPTURE_BUFFER_EVENTS 32768 // 1 MiB of events per thread between writes
+
+typedef struct captureBuffer {
+    struct captureBuffer *next; // in captureBuffers
+    int fd;
+    size_t count;
+    traceEvent events[CAPTURE_BUFFER_EVENTS];
+} captureBuffer;
+
+static pthread_once_t heapOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t heapLock = PTHREAD_MUTEX_INITIALIZER;
+static char *heapStart, *heapEnd;
+static void *heap;
+
+//capture state; captureSeq and captureBuffers are protected by heapLock
+static const char *capturePrefix;
+static uint64_t captureSeq;
+static captureBuffer *captureBuffers;
+static pthread_key_t captureKey;
+static __thread captureBuffer *threadBuffer __attribute__((tls_model("initial-exec")));
+static __thread bool threadCaptureDone __attribute__((tls_model("initial-exec"))); // set once the buffer is released
+
+//report a fatal error without going through stdio, which may call malloc
+static void fail(const char *message) {
+    ssize_t ignored = write(STDERR_FILENO, message, strlen(message));
+    (void)ignored;
+    abort();
+}
+
+static size_t getEnvNumber(const char *name, size_t fallback) {
+    const char *value = getenv(name);
+    if (!value || !*value) {
+        return fallback;
+    }
+    return (size_t)strtoull(value, NULL, 0);
+}
+
+/*
+Capture. Buffers are mmapped rather than allocated, and file names are formatted by
+hand, so nothing here calls back into malloc.
+*/
+
+static void flushCaptureBuffer(captureBuffer *buffer) {
+    const char *bytes = (const char *)buffer->events;
+    size_t length = buffer->count * sizeof(traceEvent);
+    while (length > 0) {
+        ssize_t written = write(buffer->fd, bytes, length);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            break; //the rest of the capture is lost, but the program keeps running
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    buffer->count = 0;
+}
+
+//append the decimal digits of value at out; returns the end of the digits
+static char *putDecimal(char *out, uint64_t value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+//pthread key destructor: runs when a thread that recorded calls exits
+static void releaseCaptureBuffer(void *arg) {
+    captureBuffer *buffer = (captureBuffer *)arg;
+
+    pthread_mutex_lock(&heapLock);
+    flushCaptureBuffer(buffer);
+    for (captureBuffer **link = &captureBuffers; *link; link = &(*link)->next) {
+        if (*link == buffer) {
+            *link = buffer->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&heapLock);
+
+    close(buffer->fd);
+    threadBuffer = NULL;
+    threadCaptureDone = true; //frees from later destructors must not reopen (and truncate) the file
+    munmap(buffer, sizeof(captureBuffer));
+}
+
+//the calling thread's capture buffer, made on first use; NULL if its file cannot be created
+static captureBuffer *getCaptureBuffer(void) {
+    if (threadBuffer || threadCaptureDone) {
+        return threadBuffer;
+    }
+
+    char path[4096];
+    size_t prefixLength = strlen(capturePrefix);
+    if (prefixLength + 48 > sizeof(path)) {
+        return NULL;
+    }
+    char *end = path + prefixLength;
+    memcpy(path, capturePrefix, prefixLength);
+    *end++ = '.';
+    end = putDecimal(end, (uint64_t)getpid());
+    *end++ = '.';
+    end = putDecimal(end, (uint64_t)syscall(SYS_gettid));
+    *end = '\0';
+
+    captureBuffer *buffer = mmap(NULL, sizeof(captureBuffer), PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return NULL;
+    }
+    buffer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    traceCaptureHeader header = {.heapSize = (uint64_t)(heapEnd - heapStart), .pid = (uint64_t)getpid()};
+    memcpy(header.magic, TRACE_CAPTURE_MAGIC, TRACE_MAGIC_SIZE);
+    if (buffer->fd < 0 || write(buffer->fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        if (buffer->fd >= 0) {
+            close(buffer->fd);
+        }
+        munmap(buffer, sizeof(captureBuffer));
+        return NULL;
+    }
+
+    pthread_mutex_lock(&heapLock);
+    buffer->next = captureBuffers;
+    captureBuffers = buffer;
+    pthread_mutex_unlock(&heapLock);
+    pthread_setspecific(captureKey, buffer);
+    threadBuffer = buffer;
+    return buffer;
+}
+
+//the next sequence number; the caller holds heapLock
+static uint64_t takeSequence(void) {
+    return capturePrefix ? captureSeq++ : 0;
+}
+
+static void recordEvent(traceOpCode op, uint64_t seq, const void *ptr, size_t size, const void *result) {
+    if (!capturePrefix) {
+        return;
+    }
+    captureBuffer *buffer = getCaptureBuffer();
+    if (!buffer) {
+        return;
+    }
+    buffer->events[buffer->count++] = (traceEvent){
+        (seq << TRACE_EVENT_OP_BITS) | op, (uintptr_t)ptr, size, (uintptr_t)result};
+    if (buffer->count == CAPTURE_BUFFER_EVENTS) {
+        flushCaptureBuffer(buffer);
+    }
+}
+
+/*
+Heap setup. The heap is made on the first call into the shim (or by the constructor,
+whichever comes first); the fork handlers keep the lock consistent in the child.
+*/
+
+static void initHeap(void) {
+    size_t size = getEnvNumber("CPEN212_HEAP_SIZE", PRELOAD_DEFAULT_HEAP_SIZE) & ~(size_t)7;
+    placementPolicy policy = (placementPolicy)getEnvNumber("CPEN212_POLICY", POLICY_FIRST_FIT);
+
+    void *start = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) {
+        fail("cpen212preload: cannot map the heap\n");
+    }
+    heapStart = start;
+    heapEnd = heapStart + size;
+    heap = cpen212_init_zeroed(heapStart, heapEnd, policy); //fresh anonymous pages are zero
+    if (!heap) {
+        fail("cpen212preload: cannot initialize the heap\n");
+    }
+
+    const char *prefix = getenv("CPEN212_TRACE");
+    if (prefix && *prefix && pthread_key_create(&captureKey, releaseCaptureBuffer) == 0) {
+        capturePrefix = prefix;
+    }
+}
+
+static void ensureHeap(void) {
+    pthread_once(&heapOnce, initHeap);
+}
+
+static void lockBeforeFork(void) {
+    pthread_mutex_lock(&heapLock);
+}
+
+static void unlockInParent(void) {
+    pthread_mutex_unlock(&heapLock);
+}
+
+//the child keeps the heap but starts its own capture files (named with its own pid)
+static void resetInChild(void) {
+    for (captureBuffer *buffer = captureBuffers; buffer; buffer = buffer->next) {
+        close(buffer->fd); //the parent writes out what is buffered here
+    }
+    captureBuffers = NULL;
+    threadBuffer = NULL;
+    if (capturePrefix) {
+        pthread_setspecific(captureKey, NULL);
+    }
+    pthread_mutex_init(&heapLock, NULL);
+}
+
+__attribute__((constructor)) static void startShim(void) {
+    ensureHeap();
+    pthread_atfork(lockBeforeFork, unlockInParent, resetInChild);
+}
+
+//runs as late as possible, so frees made by other destructors are still captured
+__attribute__((destructor(101))) static void stopShim(void) {
+    pthread_mutex_lock(&heapLock);
+    for (captureBuffer *buffer = captureBuffers; buffer; buffer = buffer->next) {
+        flushCaptureBuffer(buffer);
+    }
+    pthread_mutex_unlock(&heapLock);
+}
+
+static bool isHeapPointer(const void *p) {
+    return (const char *)p >= heapStart && (const char *)p < heapEnd;
+}
+
+/*
+Allocation entry points. Zero-byte requests get a real block (as glibc does), since
+many programs treat NULL from malloc(0) as running out of memory.
+*/
+
+//allocate under the lock; the caller holds heapLock
+static void *allocLocked(size_t alignment, size_t nbytes) {
+    if (nbytes == 0) {
+        nbytes = 1;
+    }
+    if (alignment < PRELOAD_MIN_ALIGNMENT) {
+        alignment = PRELOAD_MIN_ALIGNMENT;
+    }
+    return alignment > 8 ? cpen212_memalign(heap, alignment, nbytes) : cpen212_alloc(heap, nbytes);
+}
+
+static void *allocAligned(size_t alignment, size_t nbytes) {
+    ensureHeap();
+    pthread_mutex_lock(&heapLock);
+    void *p = allocLocked(alignment, nbytes);
+    uint64_t seq = takeSequence();
+    pthread_mutex_unlock(&heapLock);
+
+    recordEvent(TRACE_ALLOC, seq, NULL, nbytes, p);
+    if (!p) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void *malloc(size_t nbytes) {
+    return allocAligned(PRELOAD_MIN_ALIGNMENT, nbytes);
+}
+
+void free(void *p) {
+    if (!p || !isHeapPointer(p)) {
+        return;
+    }
+    pthread_mutex_lock(&heapLock);
+    cpen212_free(heap, p);
+    uint64_t seq = takeSequence();
+    pthread_mutex_unlock(&heapLock);
+
+    recordEvent(TRACE_FREE, seq, p, 0, NULL);
+}
+
+void *calloc(size_t n, size_t size) {
+    size_t nbytes;
+    if (__builtin_mul_overflow(n, size, &nbytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ensureHeap();
+    pthread_mutex_lock(&heapLock);
+    void *p;
+    if (PRELOAD_MIN_ALIGNMENT > 8) {
+        p = allocLocked(PRELOAD_MIN_ALIGNMENT, nbytes);
+        if (p) {
+            memset(p, 0, nbytes);
+        }
+    } else {
+        p = nbytes ? cpen212_calloc(heap, n, size) : cpen212_alloc(heap, 1);
+    }
+    uint64_t seq = takeSequence();
+    pthread_mutex_unlock(&heapLock);
+
+    recordEvent(TRACE_ALLOC, seq, NULL, nbytes, p);
+    if (!p) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void *realloc(void *prev, size_t nbytes) {
+    if (!prev) {
+        return malloc(nbytes);
+    }
+    if (nbytes == 0) {
+        free(prev);
+        return NULL;
+    }
+    if (!isHeapPointer(prev)) {
+        errno = ENOMEM; //its size is unknown, so it cannot be copied
+        return NULL;
+    }
+
+    pthread_mutex_lock(&heapLock);
+    void *p = cpen212_realloc(heap, prev, nbytes);
+    if (p && ((uintptr_t)p & (PRELOAD_MIN_ALIGNMENT - 1))) {
+        //moved blocks are only 8-byte aligned; move it again to an aligned one
+        void *aligned = allocLocked(PRELOAD_MIN_ALIGNMENT, nbytes);
+        if (aligned) {
+            memcpy(aligned, p, nbytes);
+            cpen212_free(heap, p);
+            p = aligned;
+        }
+        //otherwise keep the 8-byte aligned block: prev is gone already, and losing the data is worse
+    }
+    uint64_t seq = takeSequence();
+    pthread_mutex_unlock(&heapLock);
+
+    recordEvent(TRACE_REALLOC, seq, prev, nbytes, p);
+    if (!p) {
+        errno = ENOMEM;
+    }
+    return p;
+}
+
+void *reallocarray(void *prev, size_t n, size_t size) {
+    size_t nbytes;
+    if (__builtin_mul_overflow(n, size, &nbytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(prev, nbytes);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t nbytes) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1))) {
+        return EINVAL;
+    }
+    void *p = allocAligned(alignment, nbytes);
+    if (!p) {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t nbytes) {
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return allocAligned(alignment, nbytes);
+}
+
+//like glibc, memalign rounds an alignment that is not a power of two up to one
+void *memalign(size_t alignment, size_t nbytes) {
+    if (alignment > SIZE_MAX / 2 + 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment & (alignment - 1)) {
+        alignment = (size_t)1 << (64 - __builtin_clzl(alignment));
+    }
+    return aligned_alloc(alignment ? alignment : 1, nbytes);
+}
+
+void *valloc(size_t nbytes) {
+    return allocAligned((size_t)sysconf(_SC_PAGESIZE), nbytes);
+}
+
+void *pvalloc(size_t nbytes) {
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    if (nbytes > SIZE_MAX - (pageSize - 1)) {
+        errno = ENOMEM; //rounding up would wrap around to 0
+        return NULL;
+    }
+    return allocAligned(pageSize, (nbytes + pageSize - 1) & ~(pageSize - 1));
+}
+
+size_t malloc_usable_size(void *p) {
+    if (!p || !isHeapPointer(p)) {
+        return 0;
+    }
+    pthread_mutex_lock(&heapLock);
+    size_t usable = cpen212_usable_size(heap, p);
+    pthread_mutex_unlock(&heapLock);
+    return usable;
+}
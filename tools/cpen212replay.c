@@ -0,0 +1,1133 @@
+// Standalone trace replay benchmark for the cpen212 allocators.
+//
+// Replays a binary trace (see cpen212trace.h), the capture files recorded by the preload
+// shim (cpen212preload.c) in one process, or text traces in the syntax described in README.rst
+// ("Trace file syntax"):
+//
+//     h = init(size)
+//     p = alloc(h, size)          (optionally p = assert(alloc(h, size)))
+//     free(h, p)                  (or p = free(h, p))
+//     p = realloc(h, p, size)     (optionally wrapped in assert)
+//     debug(h, n)
+//
+// plus "name = number" assignments, "local" declarations and "--" comments.
+// Names may be plain identifiers or indexed with a literal (p[12]). Arbitrary Lua
+// is not supported; anything else is reported with its line number.
+//
+// Text traces and captures are first encoded into the binary format in memory; binary
+// traces are mmapped and streamed. Either way replay only decodes a few bytes per call, so the
+// timings are dominated by the cpen212_* calls themselves. The tool reports throughput,
+// per-operation latency percentiles, peak utilisation (live requested bytes over heap
+// bytes, or for captures over the heap's high-water mark, since the shim's heap is a
+// huge reservation) and failed allocations.
+//
+// usage: cpen212replay [-c] [-n runs] trace.lua...
+//        cpen212replay [-c] [-n runs] trace.bin
+//        cpen212replay [-c] [-n runs] capture.<pid>.*
+//        cpen212replay -o trace.bin trace.lua... | capture.<pid>.*
+//   -c       run the consistency check cpen212_debug(h, 0) after every operation and stop at
+//            the first one that fails (returns 0); only allocators whose op 0 really checks
+//            the heap are built with it (task5, whose Makefile defines REPLAY_HEAP_CHECK)
+//   -n runs  replay the trace this many times (heaps are set up afresh for each run)
+//   -o file  convert the text traces or captures to a binary trace in file instead of replaying them
+//
+// Build it against a task's allocator with "make cpen212replay" in that task's directory
+// (e.g. make cpen212replay CFLAGS="-O2 -DNDEBUG" to measure without assertions).
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "cpen212alloc.h"
+#include "cpen212trace.h"
+
+int cpen212_debug(void *alloc_state, int op);
+
+static const char *opNames[TRACE_NUM_OPS] = {"init", "alloc", "free", "realloc", "debug"};
+
+//log-linear latency histogram: values below 2^LATENCY_SUB_BITS are exact, larger ones
+//land in one of 2^LATENCY_SUB_BITS buckets per power of two (within about 6%)
+#define LATENCY_SUB_BITS 4
+#define LATENCY_BUCKETS  ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+typedef struct latencyHistogram {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total, sum, max;
+} latencyHistogram;
+
+typedef struct runStats {
+    latencyHistogram latencies[TRACE_NUM_OPS]; // nanoseconds per call
+    size_t failedAllocs, failedAsserts;
+    size_t heapBytes, liveBytes, peakLiveBytes, peakHeapBytes;
+    size_t footprintBytes, peakFootprintBytes; // how far blocks reached into the heaps, summed over heaps
+    uint64_t callNs, wallNs;
+} runStats;
+
+//runtime state of a block id
+typedef struct blockSlot {
+    void *value;
+    size_t size;    // bytes requested
+} blockSlot;
+
+typedef struct heapRecord {
+    void *memory;
+    size_t size;
+    void *handle;
+    size_t highWater;   // furthest any block reached into the heap, from its start
+} heapRecord;
+
+//a text trace variable, as the encoder sees it
+typedef enum varKind {
+    VAR_UNSET,
+    VAR_NUMBER,
+    VAR_HEAP,   // value is a heap id
+    VAR_BLOCK,  // value is a ref (0 for nil)
+} varKind;
+
+typedef struct traceVariable {
+    char *name;
+    size_t length;
+    varKind kind;
+    uint64_t value;
+} traceVariable;
+
+//text traces and captures encoded into the binary format
+typedef struct traceEncoder {
+    uint8_t *bytes;             // starts with the traceHeader
+    size_t length, capacity;
+    traceHeader header;
+    traceVariable *vars;
+    size_t numVars, varsCapacity;
+    size_t *varTable;           // open-addressed hash of var index + 1 (0 for empty)
+    size_t varTableSize;        // power of two, at least twice numVars
+    uint64_t *freeIds;          // block ids ready for reuse, most recently freed last
+    size_t numFreeIds, freeIdsCapacity;
+} traceEncoder;
+
+static void *checkedRealloc(void *p, size_t nbytes) {
+    p = realloc(p, nbytes);
+    if (!p) {
+        fprintf(stderr, "cpen212replay: out of memory\n");
+        exit(2);
+    }
+    return p;
+}
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static size_t getLatencyBucket(uint64_t ns) {
+    if (ns < (1u << LATENCY_SUB_BITS)) {
+        return (size_t)ns;
+    }
+    unsigned shift = (unsigned)(63 - __builtin_clzll(ns)) - LATENCY_SUB_BITS;
+    return ((size_t)(shift + 1) << LATENCY_SUB_BITS) + (size_t)((ns >> shift) & ((1u << LATENCY_SUB_BITS) - 1));
+}
+
+//smallest latency that lands in bucket
+static uint64_t getBucketStart(size_t bucket) {
+    if (bucket < (1u << LATENCY_SUB_BITS)) {
+        return bucket;
+    }
+    unsigned shift = (unsigned)(bucket >> LATENCY_SUB_BITS) - 1;
+    return (uint64_t)((1u << LATENCY_SUB_BITS) + (bucket & ((1u << LATENCY_SUB_BITS) - 1))) << shift;
+}
+
+static void addLatency(latencyHistogram *histogram, uint64_t ns) {
+    histogram->counts[getLatencyBucket(ns)]++;
+    histogram->total++;
+    histogram->sum += ns;
+    if (ns > histogram->max) {
+        histogram->max = ns;
+    }
+}
+
+static uint64_t getPercentile(const latencyHistogram *histogram, double percentile) {
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->total + 0.5);
+    rank = rank ? rank : 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            uint64_t start = getBucketStart(i);
+            return start < histogram->max ? start : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/*
+Text trace encoder. Variables live in vars (indices are stable) and are found through
+an open-addressed hash of their names. Each alloc or realloc result gets a block id,
+reusing the most recently released one; an id is released when its block is freed or
+reallocated, and the variable that held it becomes nil, so a stale variable can never
+name a newer block.
+*/
+
+static void ensureBytes(traceEncoder *e, size_t extra) {
+    if (e->length + extra > e->capacity) {
+        e->capacity = 2 * (e->length + extra);
+        e->bytes = checkedRealloc(e->bytes, e->capacity);
+    }
+}
+
+static void emitVarint(traceEncoder *e, uint64_t value) {
+    ensureBytes(e, TRACE_MAX_VARINT_SIZE);
+    e->length += putTraceVarint(e->bytes + e->length, value);
+}
+
+static void emitOp(traceEncoder *e, traceOpCode op, bool asserted) {
+    ensureBytes(e, 1);
+    e->bytes[e->length++] = (uint8_t)(op | (asserted ? TRACE_ASSERTED : 0));
+    e->header.numOps++;
+}
+
+static uint64_t takeBlockId(traceEncoder *e) {
+    return e->numFreeIds ? e->freeIds[--e->numFreeIds] : e->header.numBlocks++;
+}
+
+static void releaseBlockId(traceEncoder *e, uint64_t id) {
+    if (e->numFreeIds == e->freeIdsCapacity) {
+        e->freeIdsCapacity = e->freeIdsCapacity ? 2 * e->freeIdsCapacity : 1024;
+        e->freeIds = checkedRealloc(e->freeIds, e->freeIdsCapacity * sizeof(uint64_t));
+    }
+    e->freeIds[e->numFreeIds++] = id;
+}
+
+static size_t hashName(const char *name, size_t length) {
+    uint64_t hash = 14695981039346656037ull; //FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 1099511628211ull;
+    }
+    return (size_t)hash;
+}
+
+static void insertVarIndex(traceEncoder *e, size_t index) {
+    size_t mask = e->varTableSize - 1;
+    size_t i = hashName(e->vars[index].name, e->vars[index].length) & mask;
+    while (e->varTable[i]) {
+        i = (i + 1) & mask;
+    }
+    e->varTable[i] = index + 1;
+}
+
+//index of the variable called name, adding it if it is new
+static size_t getVariable(traceEncoder *e, const char *name, size_t length) {
+    if (e->varTableSize) {
+        size_t mask = e->varTableSize - 1;
+        for (size_t i = hashName(name, length) & mask; e->varTable[i]; i = (i + 1) & mask) {
+            traceVariable *var = &e->vars[e->varTable[i] - 1];
+            if (var->length == length && memcmp(var->name, name, length) == 0) {
+                return e->varTable[i] - 1;
+            }
+        }
+    }
+
+    if (2 * (e->numVars + 1) > e->varTableSize) {
+        free(e->varTable);
+        e->varTableSize = e->varTableSize ? 2 * e->varTableSize : 256;
+        e->varTable = calloc(e->varTableSize, sizeof(size_t));
+        if (!e->varTable) {
+            fprintf(stderr, "cpen212replay: out of memory\n");
+            exit(2);
+        }
+        for (size_t i = 0; i < e->numVars; i++) {
+            insertVarIndex(e, i);
+        }
+    }
+    if (e->numVars == e->varsCapacity) {
+        e->varsCapacity = e->varsCapacity ? 2 * e->varsCapacity : 256;
+        e->vars = checkedRealloc(e->vars, e->varsCapacity * sizeof(traceVariable));
+    }
+    char *copy = checkedRealloc(NULL, length + 1);
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    e->vars[e->numVars] = (traceVariable){copy, length, VAR_UNSET, 0};
+    insertVarIndex(e, e->numVars);
+    return e->numVars++;
+}
+
+/*
+Statement parser. Each parse function takes a cursor into the line, skips leading
+blanks and advances the cursor past what it accepted; it returns false (leaving the
+cursor unspecified) if the text does not match.
+*/
+
+//a call as parsed, before it is encoded
+typedef struct parsedCall {
+    traceOpCode op;
+    bool asserted;
+    size_t heap;    // variable index of the heap argument
+    size_t ptr;     // variable index of the pointer argument, or SIZE_MAX for nil
+    uint64_t size;  // size argument, or the debug op code
+} parsedCall;
+
+static void skipBlanks(const char **s) {
+    while (isspace((unsigned char)**s)) {
+        (*s)++;
+    }
+}
+
+static bool parseChar(const char **s, char c) {
+    skipBlanks(s);
+    if (**s != c) {
+        return false;
+    }
+    (*s)++;
+    return true;
+}
+
+//identifier, optionally indexed by a literal: p or p[12]
+static bool parseName(const char **s, const char **name, size_t *length) {
+    skipBlanks(s);
+    const char *start = *s;
+    if (!isalpha((unsigned char)*start) && *start != '_') {
+        return false;
+    }
+    const char *end = start;
+    while (isalnum((unsigned char)*end) || *end == '_') {
+        end++;
+    }
+    if (*end == '[') {
+        const char *close = strchr(end, ']');
+        if (!close) {
+            return false;
+        }
+        end = close + 1;
+    }
+    *name = start;
+    *length = (size_t)(end - start);
+    *s = end;
+    return true;
+}
+
+static bool isKeyword(const char *name, size_t length, const char *keyword) {
+    return strlen(keyword) == length && memcmp(name, keyword, length) == 0;
+}
+
+//a size: integer literals and numeric variables, multiplied together with *
+static bool parseSize(traceEncoder *e, const char **s, uint64_t *size) {
+    uint64_t product = 1;
+    do {
+        skipBlanks(s);
+        uint64_t value;
+        if (isdigit((unsigned char)**s)) {
+            char *end;
+            errno = 0;
+            value = strtoull(*s, &end, 0);
+            if (errno) {
+                return false;
+            }
+            *s = end;
+        } else {
+            const char *name;
+            size_t length;
+            if (!parseName(s, &name, &length)) {
+                return false;
+            }
+            traceVariable *var = &e->vars[getVariable(e, name, length)];
+            if (var->kind != VAR_NUMBER) {
+                return false;
+            }
+            value = var->value;
+        }
+        product *= value;
+    } while (parseChar(s, '*'));
+    *size = product;
+    return true;
+}
+
+//a heap variable
+static bool parseHeap(traceEncoder *e, const char **s, size_t *index) {
+    const char *name;
+    size_t length;
+    if (!parseName(s, &name, &length)) {
+        return false;
+    }
+    *index = getVariable(e, name, length);
+    return e->vars[*index].kind == VAR_HEAP;
+}
+
+//a pointer variable, or nil (SIZE_MAX)
+static bool parsePointer(traceEncoder *e, const char **s, size_t *index) {
+    const char *name;
+    size_t length;
+    if (!parseName(s, &name, &length)) {
+        return false;
+    }
+    if (isKeyword(name, length, "nil")) {
+        *index = SIZE_MAX;
+        return true;
+    }
+    *index = getVariable(e, name, length);
+    varKind kind = e->vars[*index].kind;
+    return kind == VAR_BLOCK || kind == VAR_UNSET;
+}
+
+//call := assert(call) | init(size) | alloc(h, size) | free(h, p) | realloc(h, p, size) | debug(h, n)
+static bool parseCall(traceEncoder *e, const char **s, parsedCall *call) {
+    const char *name;
+    size_t length;
+    if (!parseName(s, &name, &length) || !parseChar(s, '(')) {
+        return false;
+    }
+    if (isKeyword(name, length, "assert")) {
+        call->asserted = true;
+        return parseCall(e, s, call) && parseChar(s, ')');
+    }
+
+    for (int op = 0; op < TRACE_NUM_OPS; op++) {
+        if (isKeyword(name, length, opNames[op])) {
+            call->op = (traceOpCode)op;
+            switch (call->op) {
+            case TRACE_INIT:
+                return parseSize(e, s, &call->size) && parseChar(s, ')');
+            case TRACE_ALLOC:
+            case TRACE_DEBUG:
+                return parseHeap(e, s, &call->heap) && parseChar(s, ',')
+                       && parseSize(e, s, &call->size) && parseChar(s, ')');
+            case TRACE_FREE:
+                return parseHeap(e, s, &call->heap) && parseChar(s, ',')
+                       && parsePointer(e, s, &call->ptr) && parseChar(s, ')');
+            case TRACE_REALLOC:
+                return parseHeap(e, s, &call->heap) && parseChar(s, ',')
+                       && parsePointer(e, s, &call->ptr) && parseChar(s, ',')
+                       && parseSize(e, s, &call->size) && parseChar(s, ')');
+            default:
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+//take the block ref out of variable index (SIZE_MAX for nil), releasing its id
+static uint64_t takeRef(traceEncoder *e, size_t index) {
+    if (index == SIZE_MAX || e->vars[index].kind != VAR_BLOCK) {
+        return 0;
+    }
+    uint64_t ref = e->vars[index].value;
+    if (ref) {
+        releaseBlockId(e, ref - 1);
+    }
+    e->vars[index].value = 0;
+    return ref;
+}
+
+//encode call, and assign its result to variable dst (SIZE_MAX for none)
+static void emitCall(traceEncoder *e, const parsedCall *call, size_t dst) {
+    emitOp(e, call->op, call->asserted);
+    varKind resultKind = VAR_BLOCK;
+    uint64_t result = 0;
+    switch (call->op) {
+    case TRACE_INIT:
+        emitVarint(e, call->size);
+        resultKind = VAR_HEAP;
+        result = e->header.numHeaps++;
+        break;
+    case TRACE_ALLOC: {
+        uint64_t id = takeBlockId(e);
+        emitVarint(e, e->vars[call->heap].value);
+        emitVarint(e, id);
+        emitVarint(e, call->size);
+        result = id + 1;
+        break;
+    }
+    case TRACE_FREE:
+        emitVarint(e, e->vars[call->heap].value);
+        emitVarint(e, takeRef(e, call->ptr));
+        break;
+    case TRACE_REALLOC: {
+        uint64_t ref = takeRef(e, call->ptr);
+        uint64_t id = takeBlockId(e);
+        emitVarint(e, e->vars[call->heap].value);
+        emitVarint(e, ref);
+        emitVarint(e, id);
+        emitVarint(e, call->size);
+        result = id + 1;
+        break;
+    }
+    case TRACE_DEBUG:
+    default:
+        emitVarint(e, e->vars[call->heap].value);
+        emitVarint(e, call->size);
+        resultKind = VAR_NUMBER;
+        break;
+    }
+    if (dst != SIZE_MAX) {
+        e->vars[dst].kind = resultKind;
+        e->vars[dst].value = result;
+    }
+}
+
+//encode the statements in path; all files share e's variables, like the Lua driver's single interpreter
+static bool encodeTextTrace(const char *path, traceEncoder *e) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    unsigned lineNumber = 0;
+    bool ok = true;
+    while (ok && getline(&line, &lineCapacity, f) >= 0) {
+        lineNumber++;
+        char *comment = strstr(line, "--");
+        if (comment) {
+            *comment = '\0';
+        }
+
+        const char *s = line;
+        skipBlanks(&s);
+        if (!*s) {
+            continue;
+        }
+        if (strncmp(s, "local ", 6) == 0) {
+            s += 6;
+        }
+
+        size_t dst = SIZE_MAX;
+        const char *rest = s;
+        const char *name;
+        size_t length;
+        if (parseName(&rest, &name, &length) && parseChar(&rest, '=')) {
+            dst = getVariable(e, name, length);
+            const char *value = rest;
+            uint64_t number;
+            skipBlanks(&value);
+            if (isdigit((unsigned char)*value) && parseSize(e, &value, &number)
+                && (skipBlanks(&value), *value == '\0' || *value == ';')) {
+                e->vars[dst].kind = VAR_NUMBER;
+                e->vars[dst].value = number;
+                continue;
+            }
+            s = rest;
+        }
+
+        parsedCall call = {.ptr = SIZE_MAX};
+        ok = parseCall(e, &s, &call);
+        skipBlanks(&s);
+        ok = ok && (*s == '\0' || *s == ';');
+        if (!ok) {
+            fprintf(stderr, "%s:%u: cannot parse: %s", path, lineNumber, line);
+            break;
+        }
+        emitCall(e, &call, dst);
+    }
+    free(line);
+    fclose(f);
+    return ok;
+}
+
+static void freeEncoder(traceEncoder *e) {
+    for (size_t i = 0; i < e->numVars; i++) {
+        free(e->vars[i].name);
+    }
+    free(e->vars);
+    free(e->varTable);
+    free(e->freeIds);
+    free(e->bytes);
+}
+
+static bool writeTrace(const char *path, const uint8_t *bytes, size_t length) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    bool ok = fwrite(bytes, 1, length, f) == length;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        perror(path);
+    }
+    return ok;
+}
+
+typedef enum traceKind {
+    TRACE_KIND_TEXT,
+    TRACE_KIND_BINARY,
+    TRACE_KIND_CAPTURE,
+} traceKind;
+
+//what kind of trace path holds, judging by its magic
+static traceKind getTraceKind(const char *path) {
+    char magic[TRACE_MAGIC_SIZE];
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return TRACE_KIND_TEXT; //reported when it is opened as text
+    }
+    traceKind kind = TRACE_KIND_TEXT;
+    if (fread(magic, 1, sizeof(magic), f) == sizeof(magic)) {
+        if (memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) == 0) {
+            kind = TRACE_KIND_BINARY;
+        } else if (memcmp(magic, TRACE_CAPTURE_MAGIC, TRACE_MAGIC_SIZE) == 0) {
+            kind = TRACE_KIND_CAPTURE;
+        }
+    }
+    fclose(f);
+    return kind;
+}
+
+//map a whole file read-only; *length gets its size, which must be at least minLength
+static const uint8_t *mapTrace(const char *path, size_t minLength, size_t *length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    void *bytes = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= minLength) {
+        bytes = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (bytes == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map trace\n", path);
+        return NULL;
+    }
+    madvise(bytes, (size_t)st.st_size, MADV_SEQUENTIAL);
+    *length = (size_t)st.st_size;
+    return bytes;
+}
+
+/*
+Capture converter. The capture files of one process are merged by sequence number
+(each file is in order already) into a trace with one heap of the captured size.
+Addresses are mapped to block ids through an open-addressed table; deletion shifts
+later entries back, so lookups never need tombstones.
+*/
+
+typedef struct addressMap {
+    uint64_t *addresses;    // 0 for an empty entry
+    uint64_t *ids;
+    size_t size, count;     // size is a power of two, at least twice count
+} addressMap;
+
+typedef struct captureCursor {
+    const uint8_t *bytes;
+    size_t length;
+    const traceEvent *next, *end;
+} captureCursor;
+
+static size_t hashAddress(uint64_t address) {
+    address ^= address >> 33;
+    address *= 0xff51afd7ed558ccdull;
+    address ^= address >> 33;
+    return (size_t)address;
+}
+
+//slot holding address, or the empty slot where it would go
+static size_t findAddressSlot(const addressMap *map, uint64_t address) {
+    size_t mask = map->size - 1;
+    size_t i = hashAddress(address) & mask;
+    while (map->addresses[i] && map->addresses[i] != address) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void insertAddress(addressMap *map, uint64_t address, uint64_t id) {
+    if (2 * (map->count + 1) > map->size) {
+        addressMap grown = {NULL, NULL, map->size ? 2 * map->size : 1024, 0};
+        grown.addresses = calloc(grown.size, sizeof(uint64_t));
+        grown.ids = checkedRealloc(NULL, grown.size * sizeof(uint64_t));
+        if (!grown.addresses) {
+            fprintf(stderr, "cpen212replay: out of memory\n");
+            exit(2);
+        }
+        for (size_t i = 0; i < map->size; i++) {
+            if (map->addresses[i]) {
+                size_t slot = findAddressSlot(&grown, map->addresses[i]);
+                grown.addresses[slot] = map->addresses[i];
+                grown.ids[slot] = map->ids[i];
+            }
+        }
+        grown.count = map->count;
+        free(map->addresses);
+        free(map->ids);
+        *map = grown;
+    }
+    size_t slot = findAddressSlot(map, address);
+    map->count += !map->addresses[slot];
+    map->addresses[slot] = address;
+    map->ids[slot] = id;
+}
+
+static bool findAddress(const addressMap *map, uint64_t address, uint64_t *id) {
+    if (!map->size || !address) {
+        return false;
+    }
+    size_t slot = findAddressSlot(map, address);
+    *id = map->ids[slot];
+    return map->addresses[slot] != 0;
+}
+
+static bool removeAddress(addressMap *map, uint64_t address, uint64_t *id) {
+    if (!findAddress(map, address, id)) {
+        return false;
+    }
+    size_t mask = map->size - 1;
+    size_t hole = findAddressSlot(map, address);
+    for (size_t i = (hole + 1) & mask; map->addresses[i]; i = (i + 1) & mask) {
+        //move the entry at i into the hole unless its home slot lies cyclically in (hole, i]
+        size_t home = hashAddress(map->addresses[i]) & mask;
+        bool between = hole < i ? home > hole && home <= i : home > hole || home <= i;
+        if (!between) {
+            map->addresses[hole] = map->addresses[i];
+            map->ids[hole] = map->ids[i];
+            hole = i;
+        }
+    }
+    map->addresses[hole] = 0;
+    map->count--;
+    return true;
+}
+
+//encode one captured call; heap 0 is the captured heap
+static bool encodeEvent(traceEncoder *e, addressMap *map, const traceEvent *event) {
+    traceOpCode op = (traceOpCode)(event->seqOp & ((1u << TRACE_EVENT_OP_BITS) - 1));
+    uint64_t id, stale;
+    switch (op) {
+    case TRACE_ALLOC:
+        id = takeBlockId(e);
+        emitOp(e, TRACE_ALLOC, false);
+        emitVarint(e, 0);
+        emitVarint(e, id);
+        emitVarint(e, event->size);
+        break;
+    case TRACE_FREE: {
+        uint64_t ref = 0;
+        if (removeAddress(map, event->ptr, &id)) {
+            releaseBlockId(e, id);
+            ref = id + 1;
+        }
+        emitOp(e, TRACE_FREE, false);
+        emitVarint(e, 0);
+        emitVarint(e, ref);
+        return true;
+    }
+    case TRACE_REALLOC: {
+        //a failed realloc leaves the old block in place, so only a successful one releases its id
+        uint64_t ref = 0;
+        if (event->result ? removeAddress(map, event->ptr, &id) : findAddress(map, event->ptr, &id)) {
+            ref = id + 1;
+            if (event->result) {
+                releaseBlockId(e, id);
+            }
+        }
+        id = takeBlockId(e);
+        emitOp(e, TRACE_REALLOC, false);
+        emitVarint(e, 0);
+        emitVarint(e, ref);
+        emitVarint(e, id);
+        emitVarint(e, event->size);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    if (!event->result) {
+        releaseBlockId(e, id);
+    } else {
+        if (removeAddress(map, event->result, &stale)) {
+            releaseBlockId(e, stale); //its free was not captured
+        }
+        insertAddress(map, event->result, id);
+    }
+    return true;
+}
+
+//merge the capture files in paths, which must all come from one process, into e and set *pid to it
+static bool encodeCaptures(char **paths, int numPaths, traceEncoder *e, uint64_t *pid) {
+    captureCursor *cursors = checkedRealloc(NULL, (size_t)numPaths * sizeof(captureCursor));
+    addressMap map = {0};
+    uint64_t heapSize = 0;
+    bool ok = true;
+
+    int numMapped = 0;
+    for (; numMapped < numPaths && ok; numMapped++) {
+        captureCursor *cursor = &cursors[numMapped];
+        cursor->bytes = mapTrace(paths[numMapped], sizeof(traceCaptureHeader), &cursor->length);
+        if (!cursor->bytes) {
+            ok = false;
+            break;
+        }
+        const traceCaptureHeader *header = (const traceCaptureHeader *)cursor->bytes;
+        if (memcmp(header->magic, TRACE_CAPTURE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+            fprintf(stderr, "%s: not a capture file\n", paths[numMapped]);
+            ok = false;
+        } else if (numMapped == 0) {
+            *pid = header->pid;
+        } else if (header->pid != *pid) {
+            //addresses from different processes would be mistaken for the same blocks
+            fprintf(stderr, "%s: captured in pid %llu, but %s is from pid %llu; replay one process at a time\n",
+                    paths[numMapped], (unsigned long long)header->pid, paths[0], (unsigned long long)*pid);
+            ok = false;
+        }
+        heapSize = header->heapSize > heapSize ? header->heapSize : heapSize;
+        cursor->next = (const traceEvent *)(cursor->bytes + sizeof(traceCaptureHeader));
+        cursor->end = cursor->next + (cursor->length - sizeof(traceCaptureHeader)) / sizeof(traceEvent);
+    }
+
+    if (ok) {
+        emitOp(e, TRACE_INIT, false);
+        emitVarint(e, heapSize);
+        e->header.numHeaps++;
+    }
+    while (ok) {
+        captureCursor *earliest = NULL;
+        for (int i = 0; i < numMapped; i++) {
+            if (cursors[i].next < cursors[i].end
+                && (!earliest || cursors[i].next->seqOp < earliest->next->seqOp)) {
+                earliest = &cursors[i]; //seqOp orders by sequence number first
+            }
+        }
+        if (!earliest) {
+            break;
+        }
+        ok = encodeEvent(e, &map, earliest->next++);
+        if (!ok) {
+            fprintf(stderr, "cpen212replay: unknown captured call\n");
+        }
+    }
+
+    for (int i = 0; i < numMapped; i++) {
+        if (cursors[i].bytes) {
+            munmap((void *)cursors[i].bytes, cursors[i].length);
+        }
+    }
+    free(cursors);
+    free(map.addresses);
+    free(map.ids);
+    return ok;
+}
+
+//decode one record at *in into its fields; false if it is malformed or names an unknown heap or block
+static bool decodeRecord(const uint8_t **in, const uint8_t *end, const traceHeader *header, size_t numHeaps,
+                         traceOpCode *op, bool *asserted, uint64_t *heap, uint64_t *ref, uint64_t *id, uint64_t *size) {
+    if (*in >= end) {
+        return false;
+    }
+    uint8_t code = *(*in)++;
+    *op = (traceOpCode)(code & TRACE_OP_MASK);
+    *asserted = code & TRACE_ASSERTED;
+    *heap = *ref = *id = *size = 0;
+    switch (*op) {
+    case TRACE_INIT:
+        return getTraceVarint(in, end, size) && numHeaps < header->numHeaps;
+    case TRACE_ALLOC:
+        return getTraceVarint(in, end, heap) && getTraceVarint(in, end, id) && getTraceVarint(in, end, size)
+               && *heap < numHeaps && *id < header->numBlocks;
+    case TRACE_FREE:
+        return getTraceVarint(in, end, heap) && getTraceVarint(in, end, ref)
+               && *heap < numHeaps && *ref <= header->numBlocks;
+    case TRACE_REALLOC:
+        return getTraceVarint(in, end, heap) && getTraceVarint(in, end, ref) && getTraceVarint(in, end, id)
+               && getTraceVarint(in, end, size) && *heap < numHeaps && *ref <= header->numBlocks
+               && *id < header->numBlocks;
+    case TRACE_DEBUG:
+        return getTraceVarint(in, end, heap) && getTraceVarint(in, end, size) && *heap < numHeaps;
+    default:
+        return false;
+    }
+}
+
+//replay the records of a binary trace once into stats; returns 0 on success,
+//1 if a consistency check failed and 2 if the trace is malformed
+static int replay(const uint8_t *bytes, size_t length, bool check, runStats *stats) {
+    const traceHeader *header = (const traceHeader *)bytes;
+    const uint8_t *in = bytes + sizeof(traceHeader);
+    const uint8_t *end = bytes + length;
+    blockSlot *blocks = calloc(header->numBlocks ? header->numBlocks : 1, sizeof(blockSlot));
+    heapRecord *heaps = calloc(header->numHeaps ? header->numHeaps : 1, sizeof(heapRecord));
+    size_t numHeaps = 0;
+    int status = 0;
+    if (!blocks || !heaps) {
+        fprintf(stderr, "cpen212replay: out of memory for %llu block ids\n", (unsigned long long)header->numBlocks);
+        exit(2);
+    }
+
+    //every run starts from fresh heaps; the peaks carry over
+    stats->heapBytes = 0;
+    stats->liveBytes = 0;
+    stats->footprintBytes = 0;
+
+    uint64_t start = nowNs();
+    for (uint64_t i = 0; i < header->numOps && status == 0; i++) {
+        traceOpCode op;
+        bool asserted;
+        uint64_t heapId, ref, id, size;
+        if (!decodeRecord(&in, end, header, numHeaps, &op, &asserted, &heapId, &ref, &id, &size)) {
+            fprintf(stderr, "cpen212replay: malformed trace record %llu\n", (unsigned long long)i);
+            status = 2;
+            break;
+        }
+
+        void *h = op == TRACE_INIT ? NULL : heaps[heapId].handle;
+        blockSlot *prev = ref ? &blocks[ref - 1] : NULL;
+        void *result = NULL;
+        uint64_t before, after;
+
+        switch (op) {
+        case TRACE_INIT: {
+            //the driver owns the heap memory; mapped lazily, so huge captured heaps only cost what they touch
+            void *memory = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (memory == MAP_FAILED) {
+                fprintf(stderr, "cpen212replay: cannot get %llu bytes for a heap\n", (unsigned long long)size);
+                exit(2);
+            }
+            before = nowNs();
+            result = cpen212_init(memory, (char *)memory + size);
+            after = nowNs();
+            heaps[numHeaps++] = (heapRecord){memory, size, result, 0};
+            stats->heapBytes += size;
+            h = result;
+            break;
+        }
+        case TRACE_ALLOC:
+            before = nowNs();
+            result = cpen212_alloc(h, size);
+            after = nowNs();
+            if (result) {
+                stats->liveBytes += size;
+            } else if (size) {
+                stats->failedAllocs++;
+                stats->failedAsserts += asserted;
+            }
+            blocks[id] = (blockSlot){result, result ? size : 0};
+            break;
+        case TRACE_FREE:
+            before = nowNs();
+            cpen212_free(h, prev ? prev->value : NULL);
+            after = nowNs();
+            if (prev) {
+                stats->liveBytes -= prev->size;
+                *prev = (blockSlot){NULL, 0};
+            }
+            break;
+        case TRACE_REALLOC: {
+            void *prevValue = prev ? prev->value : NULL;
+            before = nowNs();
+            result = cpen212_realloc(h, prevValue, size);
+            after = nowNs();
+            if (result) {
+                if (prev) {
+                    stats->liveBytes -= prev->size;
+                    *prev = (blockSlot){NULL, 0};
+                }
+                stats->liveBytes += size;
+            } else if (size) {
+                stats->failedAllocs++;
+                stats->failedAsserts += asserted;
+            }
+            //a failed realloc leaves prev allocated; its id may be reused, so it stays counted as live
+            blocks[id] = (blockSlot){result, result ? size : 0};
+            break;
+        }
+        case TRACE_DEBUG:
+        default:
+            before = nowNs();
+            cpen212_debug(h, (int)size);
+            after = nowNs();
+            break;
+        }
+
+        if (result && (op == TRACE_ALLOC || op == TRACE_REALLOC)) {
+            size_t reached = (size_t)((char *)result - (char *)heaps[heapId].memory) + size;
+            if (reached > heaps[heapId].highWater) {
+                stats->footprintBytes += reached - heaps[heapId].highWater;
+                heaps[heapId].highWater = reached;
+            }
+        }
+        if (stats->footprintBytes > stats->peakFootprintBytes) {
+            stats->peakFootprintBytes = stats->footprintBytes;
+        }
+
+        addLatency(&stats->latencies[op], after - before);
+        if (op != TRACE_DEBUG) {
+            stats->callNs += after - before;
+        }
+        if (stats->liveBytes > stats->peakLiveBytes) {
+            stats->peakLiveBytes = stats->liveBytes;
+            stats->peakHeapBytes = stats->heapBytes;
+        }
+
+        if (check && op != TRACE_DEBUG && h && cpen212_debug(h, 0) == 0) {
+            fprintf(stderr, "record %llu: heap check failed after %s\n", (unsigned long long)i, opNames[op]);
+            status = 1;
+        }
+    }
+    stats->wallNs += nowNs() - start;
+
+    for (size_t i = 0; i < numHeaps; i++) {
+        munmap(heaps[i].memory, heaps[i].size ? heaps[i].size : 1);
+    }
+    free(heaps);
+    free(blocks);
+    return status;
+}
+
+//captured heaps are as big as the shim's reservation, so their utilisation is taken
+//against how far into the heap blocks reached instead
+static void printReport(const char *name, size_t runs, const runStats *stats, bool captured) {
+    uint64_t totalOps = 0;
+    for (int op = 0; op < TRACE_NUM_OPS; op++) {
+        if (op != TRACE_DEBUG) {
+            totalOps += stats->latencies[op].total;
+        }
+    }
+
+    printf("%s: %llu operations over %zu run(s) (alloc %llu, free %llu, realloc %llu)\n", name,
+           (unsigned long long)totalOps, runs, (unsigned long long)stats->latencies[TRACE_ALLOC].total,
+           (unsigned long long)stats->latencies[TRACE_FREE].total,
+           (unsigned long long)stats->latencies[TRACE_REALLOC].total);
+    if (stats->callNs) {
+        printf("throughput: %.2f Mops/s in cpen212_* calls (%.3f ms in calls, %.3f ms wall)\n",
+               (double)totalOps * 1e3 / (double)stats->callNs, stats->callNs / 1e6, stats->wallNs / 1e6);
+    }
+
+    printf("%-8s %10s %10s %10s %10s %10s %10s\n", "ns", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int op = 0; op < TRACE_NUM_OPS; op++) {
+        const latencyHistogram *histogram = &stats->latencies[op];
+        if (!histogram->total) {
+            continue;
+        }
+        printf("%-8s %10.0f %10llu %10llu %10llu %10llu %10llu\n", opNames[op],
+               (double)histogram->sum / (double)histogram->total,
+               (unsigned long long)getPercentile(histogram, 50), (unsigned long long)getPercentile(histogram, 90),
+               (unsigned long long)getPercentile(histogram, 99), (unsigned long long)getPercentile(histogram, 99.9),
+               (unsigned long long)histogram->max);
+    }
+
+    if (captured && stats->peakFootprintBytes) {
+        printf("peak utilisation: %.1f%% (%zu live requested bytes / %zu heap bytes reached)\n",
+               100.0 * (double)stats->peakLiveBytes / (double)stats->peakFootprintBytes,
+               stats->peakLiveBytes, stats->peakFootprintBytes);
+    } else if (!captured && stats->peakHeapBytes) {
+        printf("peak utilisation: %.1f%% (%zu live requested bytes / %zu heap bytes)\n",
+               100.0 * (double)stats->peakLiveBytes / (double)stats->peakHeapBytes,
+               stats->peakLiveBytes, stats->peakHeapBytes);
+    }
+    printf("failed allocations: %zu (%zu inside assert)\n", stats->failedAllocs, stats->failedAsserts);
+}
+
+//the trace file, or for captures <prefix>.<pid>.* with the pid from the files' headers
+//and the prefix from the first file's name (written to buffer)
+static const char *getReportName(char **paths, int numPaths, traceKind kind, uint64_t pid, char *buffer, size_t size) {
+    if (kind != TRACE_KIND_CAPTURE) {
+        return paths[numPaths - 1];
+    }
+    //drop the .<pid>.<tid> the shim put on the file name, if it is there
+    size_t prefixLength = strlen(paths[0]);
+    for (int dots = 0; dots < 2; dots++) {
+        size_t i = prefixLength;
+        while (i > 0 && paths[0][i - 1] != '.' && paths[0][i - 1] != '/') {
+            i--;
+        }
+        if (i == 0 || paths[0][i - 1] != '.') {
+            break;
+        }
+        prefixLength = i - 1;
+    }
+    snprintf(buffer, size, "%.*s.%llu.*", (int)prefixLength, paths[0], (unsigned long long)pid);
+    return buffer;
+}
+
+int main(int argc, char **argv) {
+    bool check = false;
+    size_t runs = 1;
+    const char *outPath = NULL;
+    int argi = 1;
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strcmp(argv[argi], "-c") == 0) {
+#ifdef REPLAY_HEAP_CHECK
+            check = true;
+#else
+            fprintf(stderr, "%s: -c needs an allocator whose cpen212_debug(h, 0) checks the heap "
+                            "(build with -DREPLAY_HEAP_CHECK)\n", argv[0]);
+            return 2;
+#endif
+        } else if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc) {
+            runs = strtoul(argv[++argi], NULL, 0);
+        } else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+            outPath = argv[++argi];
+        } else {
+            break;
+        }
+    }
+    traceKind kind = argi < argc ? getTraceKind(argv[argi]) : TRACE_KIND_TEXT;
+    bool binary = kind == TRACE_KIND_BINARY;
+    if (argi >= argc || runs == 0 || (binary && (outPath || argi + 1 != argc))) {
+        fprintf(stderr, "usage: %s [-c] [-n runs] trace.lua...\n"
+                        "       %s [-c] [-n runs] trace.bin\n"
+                        "       %s [-c] [-n runs] capture.pid.*\n"
+                        "       %s -o trace.bin trace.lua... | capture.pid.*\n", argv[0], argv[0], argv[0], argv[0]);
+        return 2;
+    }
+
+    const uint8_t *bytes;
+    size_t length;
+    traceEncoder encoder = {0};
+    uint64_t capturePid = 0;
+    if (binary) {
+        bytes = mapTrace(argv[argi], sizeof(traceHeader), &length);
+        if (!bytes) {
+            return 2;
+        }
+    } else {
+        ensureBytes(&encoder, sizeof(traceHeader));
+        encoder.length = sizeof(traceHeader);
+        bool ok = kind == TRACE_KIND_CAPTURE ? encodeCaptures(argv + argi, argc - argi, &encoder, &capturePid) : true;
+        for (int i = argi; i < argc && ok && kind == TRACE_KIND_TEXT; i++) {
+            ok = encodeTextTrace(argv[i], &encoder);
+        }
+        if (!ok) {
+            freeEncoder(&encoder);
+            return 2;
+        }
+        memcpy(encoder.header.magic, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+        memcpy(encoder.bytes, &encoder.header, sizeof(traceHeader));
+        bytes = encoder.bytes;
+        length = encoder.length;
+    }
+
+    int status = 0;
+    if (outPath) {
+        status = writeTrace(outPath, bytes, length) ? 0 : 2;
+    } else {
+        runStats *stats = calloc(1, sizeof(runStats));
+        if (!stats) {
+            fprintf(stderr, "cpen212replay: out of memory\n");
+            return 2;
+        }
+        for (size_t run = 0; run < runs && status == 0; run++) {
+            status = replay(bytes, length, check, stats);
+        }
+        char name[4096];
+        printReport(getReportName(argv + argi, argc - argi, kind, capturePid, name, sizeof(name)), runs, stats,
+                    kind == TRACE_KIND_CAPTURE);
+        free(stats);
+    }
+
+    if (binary) {
+        munmap((void *)bytes, length);
+    } else {
+        freeEncoder(&encoder);
+    }
+    return status;
+}
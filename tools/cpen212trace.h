@@ -0,0 +1,103 @@
+#ifndef __CPEN212TRACE_H__
+#define __CPEN212TRACE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact binary trace format, shared by the replay benchmark and trace capture.
+//
+// A trace is a traceHeader followed by header.numOps records. Each record is one
+// op byte (a traceOpCode, with TRACE_ASSERTED set if the call was wrapped in assert)
+// followed by unsigned LEB128 varints:
+//
+//     TRACE_INIT     size                  heap ids are handed out in order, from 0
+//     TRACE_ALLOC    heap id size
+//     TRACE_FREE     heap ref
+//     TRACE_REALLOC  heap ref id size      id names the result (NULL if it fails)
+//     TRACE_DEBUG    heap op
+//
+// Blocks are named by ids rather than addresses. An id can be reused once its block
+// has been freed or reallocated, so writers that reuse ids keep them below the peak
+// number of live blocks and the replayer's id table small. A ref is 0 for a NULL
+// pointer and id + 1 otherwise. Header fields are little-endian.
+
+#define TRACE_MAGIC      "C212TRC\001"
+#define TRACE_MAGIC_SIZE 8
+
+#define TRACE_OP_MASK  0x07
+#define TRACE_ASSERTED 0x08
+
+#define TRACE_MAX_VARINT_SIZE 10 // bytes in the encoding of the largest uint64_t
+
+typedef enum traceOpCode {
+    TRACE_INIT,
+    TRACE_ALLOC,
+    TRACE_FREE,
+    TRACE_REALLOC,
+    TRACE_DEBUG,
+    TRACE_NUM_OPS,
+} traceOpCode;
+
+typedef struct traceHeader {
+    char magic[TRACE_MAGIC_SIZE];
+    uint64_t numOps;
+    uint64_t numBlocks; // block ids are all below this
+    uint64_t numHeaps;  // number of TRACE_INIT records
+} traceHeader;
+
+// Capture files hold calls recorded by the preload shim (cpen212preload.c): a
+// traceCaptureHeader followed by fixed-size traceEvents, one file per thread. Every
+// event carries a process-wide sequence number, so the files can be merged back into
+// call order; cpen212replay turns them into a trace, mapping addresses to block ids.
+// Addresses only mean something within one process, so every file names its pid.
+
+#define TRACE_CAPTURE_MAGIC "C212CAP\002"
+
+#define TRACE_EVENT_OP_BITS 8 // traceEvent.seqOp holds (sequence number << TRACE_EVENT_OP_BITS) | traceOpCode
+
+typedef struct traceCaptureHeader {
+    char magic[TRACE_MAGIC_SIZE];
+    uint64_t heapSize;  // size of the heap the calls were served from
+    uint64_t pid;       // process the calls were made in
+} traceCaptureHeader;
+
+typedef struct traceEvent {
+    uint64_t seqOp;
+    uint64_t ptr;       // pointer argument (TRACE_FREE, TRACE_REALLOC)
+    uint64_t size;      // bytes requested
+    uint64_t result;    // pointer returned (TRACE_ALLOC, TRACE_REALLOC)
+} traceEvent;
+
+// description:
+// - encode value at out
+// returns:
+// - the number of bytes written (at most TRACE_MAX_VARINT_SIZE)
+static inline size_t putTraceVarint(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+// description:
+// - decode a varint at *in and advance *in past it
+// returns:
+// - false if the encoding runs past end or is too long for a uint64_t
+static inline bool getTraceVarint(const uint8_t **in, const uint8_t *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (unsigned shift = 0; *in < end && shift < 64; shift += 7) {
+        uint8_t byte = *(*in)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // __CPEN212TRACE_H__